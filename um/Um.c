@@ -10,14 +10,77 @@
  *      simple input and output. Uses the Um_registers and Um_segments
  *      modules to represent the registers and memory, respectively. 
  *
+ *      Segment 0 is kept alongside a cache of pre-decoded instructions
+ *      so that the main loop does not unpack every word it executes.
+ *      The cache is rebuilt whenever segment 0 is replaced by LOADP and
+ *      is patched by range whenever SSTORE writes into segment 0.
+ *      Hosts that run many UMs can load programs through the Um_image
+ *      cache (see UM_share_images()): UMs running the same program then
+ *      map one copy of segment 0 and of its decoded form privately, so
+ *      they share every page that none of them writes.
+ *      Common instruction pairs (an LV feeding a load, store or ALU
+ *      operation, and CMOV before LOADP) are fused in the cache: the
+ *      first word of the pair gets a fused opcode whose handler runs
+ *      both instructions with one dispatch. Every other word keeps its
+ *      own decoding, so a jump into the middle of a pair still works.
+ *
+ *      Output is collected in a buffer inside the UM and written to
+ *      standard output with write(2) in large blocks. The buffer is
+ *      drained when it fills, when the UM halts or fails, when it is
+ *      freed, before an IN that would block waiting for input, and, if
+ *      a flush interval is set, whenever OUT finds the oldest buffered
+ *      byte older than the interval. Input is read through the Um_input
+ *      module.
+ *
+ *      Every engine is built into every UM and chosen per UM with
+ *      UM_set_engine(); the ENGINE the UM is built with only sets the
+ *      default. The engines share the decoded cache and must leave a UM
+ *      in exactly the same state after the same number of instructions,
+ *      which the Um_verify module checks by running two of them side by
+ *      side. A block optimizer with constant folding and dead write
+ *      removal was tried as a further engine and lost to threaded
+ *      dispatch: any SSTORE may leave a block, so every register stays
+ *      live across it and few operations can be removed.
+ *
+ *      UM_run() and UM_run_for() return a status instead of exiting, so
+ *      a UM can be embedded in another program and run in slices. An
+ *      instruction that stops the UM (HALT, an IN with no input ready,
+ *      or a fault) calls stop() and makes UM_execute() return false; the
+ *      engines return as soon as they see that, or when fewer than
+ *      MAX_FUSED instructions are left in the budget. The rest of the
+ *      budget is then spent one instruction at a time, so a fusion never
+ *      takes the UM past its budget.
+ *
+ *      A host program can instead feed input with UM_push_input(): IN
+ *      then never waits, and a UM that runs out of input returns
+ *      UM_BLOCKED until more is pushed, so one thread can drive many
+ *      interactive UMs, each writing to its own output descriptor.
+ *      Output can also be captured in memory, for hosts that run many
+ *      UMs as batch jobs.
+ *
+ *      A UM can be saved to a snapshot with the Um_snapshot module, on
+ *      request or just before its first IN, and a later UM can continue
+ *      from the snapshot. Output written before the snapshot is not
+ *      part of it.
+ *
  *******************************************************/
 
+#define _DEFAULT_SOURCE
+
 #include "Um.h"
-#include <sys/stat.h>
-#include <um-dis.h>
+#include "Um_jit.h"
+#include "Um_load.h"
+#include "Um_image.h"
+#include "Um_input.h"
+#include "Um_profile.h"
+#include "Um_snapshot.h"
 #include <string.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 /*******************************************************
  *
@@ -25,14 +88,6 @@
  *
  *******************************************************/
 
-#define THREE_BYTES 24
-#define ONE_BYTE 8
-#define LOW_ORDER_MASK 0xff
-#define HIGH_ORDER_MASK 0xff000000
-#define MID_HIGH_ORDER_MASK 0xff0000
-#define MID_LOW_ORDER_MASK 0xff00
-
-
 #define CODE_SEG 0
 #define OP_WIDTH 4
 #define REG_WIDTH 3
@@ -47,6 +102,10 @@
 
 #define EOF_FLAG ~0
 
+#define OUT_BUF_SIZE (64 * 1024)
+
+#define UNLIMITED UINT64_MAX
+
 typedef uint32_t Um_instruction;
 
 typedef enum Um_register { r0 = 0, r1, r2, r3, r4, r5, r6, r7 } Um_register;
@@ -56,24 +115,90 @@ typedef enum Um_opcode {
         NAND, HALT, MAP, UNMAP, OUT, IN, LOADP, LV
 } Um_opcode;
 
+/* Fused opcodes exist only in the decoded cache. Each is named after the
+ * instructions it runs, starting with the word it is stored on; opcodes
+ * 14 and 15 are left to invalid instructions.
+ */
+typedef enum Um_fused_opcode {
+        LV_SLOAD = 16, LV_SSTORE, LV_ADD, LV_NAND, LV_LV, LV_LV_NAND,
+        CMOV_LOADP, NUM_OPCODES
+} Um_fused_opcode;
+
+#define MAX_FUSED 3
+
+/* The opcode of the word each decoded opcode is stored on */
+static const uint8_t fusion_first[NUM_OPCODES] = {
+        CMOV, SLOAD, SSTORE, ADD, MUL, DIV, NAND, HALT,
+        MAP, UNMAP, OUT, IN, LOADP, LV, 14, 15,
+        LV, LV, LV, LV, LV, LV, CMOV
+};
+
+/* The number of instructions each decoded opcode runs */
+static const uint8_t fusion_length[NUM_OPCODES] = {
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        2, 2, 2, 2, 2, 3, 2
+};
+
+/* The engine UM_run() uses unless UM_set_engine() picks another; set
+ * with ENGINE in the Makefile
+ */
+#ifndef UM_DEFAULT_ENGINE
+#define UM_DEFAULT_ENGINE UM_ENGINE_SWITCH
+#endif
+
+/* Whether UM_new() loads programs through the Um_image cache; see
+ * UM_share_images()
+ */
+static bool share_images = false;
+
+static const char *const engine_names[UM_NUM_ENGINES] = {
+        "switch", "threaded", "jit"
+};
+
+/* What is left of each fusion after its first instruction */
+static const uint8_t fusion_rest[NUM_OPCODES] = {
+        [LV_SLOAD] = SLOAD, [LV_SSTORE] = SSTORE, [LV_ADD] = ADD,
+        [LV_NAND] = NAND, [LV_LV] = LV, [LV_LV_NAND] = LV_NAND,
+        [CMOV_LOADP] = LOADP
+};
+
+/* A decoded instruction. Packed into 8 bytes so that the decoded copy
+ * of segment 0 stays small and one indexed load fetches a whole
+ * instruction. For LV, ra holds the destination register.
+ */
 typedef struct Instructions {
-        Um_opcode op;
-        Um_register ra;
-        Um_register rb;
-        Um_register rc;
-        Um_register lv_ra;
+        uint8_t op;
+        uint8_t ra;
+        uint8_t rb;
+        uint8_t rc;
         Word lv_val;
 } Instructions;
 
-struct Segments {
-        Seq_T available_IDs;
-        Seq_T seg_array; 
-};
-
 struct UM {
         Register *registers;
         Segments segments;
         uint32_t counter;     
+        Instructions *decoded;
+        uint32_t decoded_length;
+        size_t decoded_mapped;  /* bytes if mapped from an image, or 0 */
+        UM_engine engine;
+        UM_jit jit;
+        UM_input input;
+        UM_profile profile;
+        const char *snapshot_path;
+        UM_status status;
+        bool stopped;
+        bool finished;
+        bool blocking;
+        bool hosted_input;
+        int out_fd;
+        unsigned char *capture;
+        size_t capture_length;
+        size_t capture_size;
+        unsigned flush_interval_ms;
+        struct timespec first_output;
+        size_t out_length;
+        unsigned char out_buf[OUT_BUF_SIZE];
 };
 
 /*******************************************************
@@ -82,22 +207,6 @@ struct UM {
  *
  *******************************************************/
 
-/* swap_endian() function
- * Parameters:  word: uint32_t type
- *
- * Returns:     Word with swapped endian: uint32_t type
- *
- * Purpose:     Swaps the endian-ness of the given uint32_t and returns 
- *              the result. 
- */     
-static inline uint32_t swap_endian(uint32_t word)
-{
-        return ((word >> THREE_BYTES) & LOW_ORDER_MASK) |
-                ((word << ONE_BYTE) & MID_HIGH_ORDER_MASK) |
-                ((word >> ONE_BYTE) & MID_LOW_ORDER_MASK) |
-                ((word << THREE_BYTES) & HIGH_ORDER_MASK);
-}
-
 /* init_instructions() function
  * Parameters:  none
  *
@@ -113,63 +222,35 @@ static inline Instructions init_instructions()
         instr.ra = 0;
         instr.rb = 0;
         instr.rc = 0;
-        instr.lv_ra = 0;
         instr.lv_val = 0;
         return instr;
 }
 
-/* read_program() function
- * Parameters:  um: UM type; program: char * type
+/* code_words() function
+ * Parameters:  um: UM type
  *
- * Returns:     void
+ * Returns:     Pointer to the first word of segment 0
  *
- * Purpose:     Reads the um program in the given file and initializes 
- *              Segment O in the given UM to store the UM instructions
- *              read from the program.
+ * Purpose:     Returns a pointer to the raw words of the code segment of
+ *              the given UM.
  */
-static inline void read_program(UM um, char *program)
+static inline Word *code_words(UM um)
 {
-        struct stat buffer;
-        FILE *fp;
-        size_t instr_size = sizeof(Um_instruction);
-        int num_instr, i;
-
-        stat(program, &buffer);
-        fp = fopen(program, "r");
-        if (fp == NULL) {
-                fprintf(stderr, "Could not open file %s for reading\n", 
-                        program);
-                exit(EXIT_FAILURE);
-        }
-        num_instr = buffer.st_size / instr_size;
-        Um_instruction stream[num_instr];
-        UMSegment_map(um->segments, num_instr, NULL, 0);
-        fread(stream, instr_size, (size_t) num_instr, fp);
-        for (i = 0; i < num_instr; i++) {
-                stream[i] = swap_endian(stream[i]);
-                UMSegment_insert(um->segments, CODE_SEG, i, stream[i]);
-        }
-        fclose(fp);
+        return um->segments->seg_array[CODE_SEG];
 }
 
 /* unpack_instruction() function
- * Parameters:  um: UM type
+ * Parameters:  raw_instr: Um_instruction type
  *
  * Returns:     Instructions struct
  *
- * Purpose:     Reads the instruction in the code segment of the given 
- *              UM pointed too by the UM program counter. Unpacks the 
- *              instruction fields into a new Instructions struct using the 
- *              Bitpack interface and returns the Instructions struct.
+ * Purpose:     Unpacks the fields of the given UM instruction word into
+ *              a new Instructions struct and returns the Instructions
+ *              struct. Only the fields used by the opcode are filled in.
  */
-static inline Instructions unpack_instruction(UM um)
+static inline Instructions unpack_instruction(Um_instruction raw_instr)
 {
         Instructions new_instr = init_instructions();
-	Segments segments = um->segments;
-	UArray_T curr_segment = Seq_get((segments->seg_array), CODE_SEG);
-        Word *word = (uint32_t *)(curr_segment->elems + (um->counter * curr_segment->size));
-        Um_instruction raw_instr = *word;
-	  //UMSegment_at(um->segments, CODE_SEG, um->counter);
         unsigned hi = OP_LSB + OP_WIDTH;
         new_instr.op = ((raw_instr << (32 - hi)) >> (32 - OP_WIDTH));
 
@@ -178,7 +259,7 @@ static inline Instructions unpack_instruction(UM um)
 
         if (new_instr.op == LV) {
                 hi = A_LV_LSB + REG_WIDTH;
-                new_instr.lv_ra = ((raw_instr << (32 - hi)) >> (32 - REG_WIDTH));
+                new_instr.ra = ((raw_instr << (32 - hi)) >> (32 - REG_WIDTH));
                 hi = LV_LSB + LV_WIDTH;
                 new_instr.lv_val = ((raw_instr << (32 - hi)) >> (32 - LV_WIDTH));
 
@@ -196,88 +277,515 @@ static inline Instructions unpack_instruction(UM um)
         } else {
                 hi = A_LSB + REG_WIDTH;
                 new_instr.ra = ((raw_instr << (32 - hi)) >> (32 - REG_WIDTH));
-                
+
                 hi = B_LSB + REG_WIDTH;
                 new_instr.rb = ((raw_instr << (32 - hi)) >> (32 - REG_WIDTH));
-                
+
                 hi = C_LSB + REG_WIDTH;
                 new_instr.rc = ((raw_instr << (32 - hi)) >> (32 - REG_WIDTH));
-        } 
+        }
 
         return new_instr;
 }
 
+/* fused_opcode() function
+ * Parameters:  code: const Word * type; i: uint32_t type;
+ *              length: uint32_t type
+ *
+ * Returns:     Opcode to store in the decoded cache for word i: uint8_t
+ *
+ * Purpose:     Picks the fused opcode for the instructions starting at
+ *              word i of a segment 0 of the given length, or the plain
+ *              opcode of word i when no fusion applies. A fusion never
+ *              reads past the end of the segment, and only its last
+ *              instruction may store into memory or jump.
+ */
+static inline uint8_t fused_opcode(const Word *code, uint32_t i,
+                                   uint32_t length)
+{
+        unsigned op = code[i] >> OP_LSB;
+        unsigned next;
+
+        if (i + 1 >= length)
+                return op;
+        next = code[i + 1] >> OP_LSB;
+        if (op == CMOV)
+                return next == LOADP ? CMOV_LOADP : CMOV;
+        if (op != LV)
+                return op;
+
+        switch (next) {
+        case SLOAD:
+                return LV_SLOAD;
+        case SSTORE:
+                return LV_SSTORE;
+        case ADD:
+                return LV_ADD;
+        case NAND:
+                return LV_NAND;
+        case LV:
+                if (i + 2 < length && code[i + 2] >> OP_LSB == NAND)
+                        return LV_LV_NAND;
+                return LV_LV;
+        default:
+                return op;
+        }
+}
+
+/* fuse_range() function
+ * Parameters:  um: UM type; lo: uint32_t type; hi: uint32_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Recomputes the fused opcodes of every word of the decoded
+ *              cache whose fusion may cover a word in [lo, hi).
+ */
+static void fuse_range(UM um, uint32_t lo, uint32_t hi)
+{
+        Word *code = code_words(um);
+        uint32_t i;
+
+        for (i = lo < MAX_FUSED ? 0 : lo - (MAX_FUSED - 1); i < hi; i++)
+                um->decoded[i].op = fused_opcode(code, i,
+                                                 um->decoded_length);
+}
+
+/* free_decoded() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Frees or unmaps the decoded instruction cache of the given
+ *              UM.
+ */
+static void free_decoded(UM um)
+{
+        if (um->decoded_mapped != 0)
+                munmap(um->decoded, um->decoded_mapped);
+        else
+                free(um->decoded);
+        um->decoded = NULL;
+        um->decoded_mapped = 0;
+}
+
+/* invalidate_decoded() function
+ * Parameters:  um: UM type; lo: uint32_t type; hi: uint32_t type
+ *
+ * Returns:     true if a JIT translation was dropped: bool type
+ *
+ * Purpose:     Re-decodes the words in [lo, hi) of segment 0 into the
+ *              decoded instruction cache of the given UM and drops any
+ *              JIT translations of them. Called after any write into
+ *              segment 0. Fusions depend only on opcodes, so they are
+ *              recomputed only when a word's opcode changed; programs
+ *              that keep data in segment 0 store into it constantly.
+ */
+static inline bool invalidate_decoded(UM um, uint32_t lo, uint32_t hi)
+{
+        Word *code = code_words(um);
+        Instructions *decoded = um->decoded;
+        bool refuse = false;
+        bool dropped = false;
+        uint32_t i;
+        uint8_t op;
+
+        for (i = lo; i < hi; i++) {
+                op = decoded[i].op;
+                decoded[i] = unpack_instruction(code[i]);
+                if (fusion_first[op] == decoded[i].op)
+                        decoded[i].op = op;
+                else
+                        refuse = true;
+        }
+        if (refuse)
+                fuse_range(um, lo, hi);
+        if (um->jit != NULL)
+                dropped = UMJit_invalidate(um->jit, lo, hi) != 0;
+        return dropped;
+}
+
+/* rebuild_decoded() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Resizes the decoded instruction cache of the given UM to
+ *              the length of segment 0 and decodes the whole segment.
+ *              Called whenever segment 0 is replaced, so it also drops
+ *              all JIT translations.
+ */
+static void rebuild_decoded(UM um)
+{
+        uint32_t length = UMSegment_length(um->segments, CODE_SEG);
+        Word *code = code_words(um);
+        uint32_t i;
+
+        if (length > um->decoded_length || um->decoded == NULL ||
+            um->decoded_mapped != 0) {
+                free_decoded(um);
+                um->decoded = malloc((length + 1) * sizeof(Instructions));
+                if (um->decoded == NULL) {
+                        fprintf(stderr, "Out of memory decoding program\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        um->decoded_length = length;
+        if (um->jit != NULL)
+                UMJit_reset(um->jit, length);
+        for (i = 0; i < length; i++)
+                um->decoded[i] = unpack_instruction(code[i]);
+        fuse_range(um, 0, length);
+        if (um->profile != NULL)
+                UMProfile_resize(um->profile, length);
+}
+
+/* load_program() function
+ * Parameters:  um: UM type; src: Segment_ID type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Replaces segment 0 of the given UM with a copy of the
+ *              segment with ID src and rebuilds the decoded instruction
+ *              cache. Used by LOADP when jumping to a segment other than
+ *              segment 0. When the new segment 0 holds the same words as
+ *              the old one, the decoded cache and JIT translations stay
+ *              valid and are kept.
+ */
+static void load_program(UM um, Segment_ID src)
+{
+        bool same = UMSegment_equal(um->segments, src, CODE_SEG);
+
+        UMSegment_copy(um->segments, src, CODE_SEG);
+        if (!same)
+                rebuild_decoded(um);
+        else if (um->profile != NULL)
+                UMProfile_resize(um->profile, um->decoded_length);
+}
+
+/* read_program() function
+ * Parameters:  um: UM type; program: char * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Reads the um program in the given file and initializes 
+ *              Segment O in the given UM to store the UM instructions
+ *              read from the program. If the image cache is on (see
+ *              UM_share_images()), segment 0 and the decoded cache are
+ *              mapped from the program's cached image when there is one;
+ *              the first UM to run an image decodes it and shares the
+ *              result. Otherwise the program is loaded privately.
+ */
+static inline void read_program(UM um, char *program)
+{
+        UM_image image = share_images ? UMImage_open(program) : NULL;
+        size_t length;
+        void *segment;
+
+        if (image == NULL) {
+                UMLoad_program(um->segments, program);
+                rebuild_decoded(um);
+                return;
+        }
+        segment = UMImage_map_segment(image, &length);
+        UMSegment_adopt(um->segments, segment, length);
+        um->decoded = UMImage_map_decoded(image, &um->decoded_mapped);
+        if (um->decoded != NULL) {
+                um->decoded_length = UMSegment_length(um->segments,
+                                                      CODE_SEG);
+        } else {
+                rebuild_decoded(um);
+                um->decoded[um->decoded_length] = init_instructions();
+                UMImage_share_decoded(image, um->decoded,
+                                      ((size_t) um->decoded_length + 1) *
+                                      sizeof(Instructions));
+        }
+        UMImage_release(image);
+}
+
+/* capture_output() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Appends the given UM's output buffer to its capture
+ *              buffer, growing it as needed.
+ */
+static void capture_output(UM um)
+{
+        size_t needed = um->capture_length + um->out_length;
+        size_t size = um->capture_size;
+        unsigned char *capture;
+
+        if (needed > size) {
+                while (size < needed)
+                        size = size == 0 ? OUT_BUF_SIZE : size * 2;
+                capture = realloc(um->capture, size);
+                if (capture == NULL) {
+                        fprintf(stderr, "Out of memory capturing output\n");
+                        exit(EXIT_FAILURE);
+                }
+                um->capture = capture;
+                um->capture_size = size;
+        }
+        memcpy(um->capture + um->capture_length, um->out_buf,
+               um->out_length);
+        um->capture_length = needed;
+}
+
+/* flush_output() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes everything in the given UM's output buffer to
+ *              its output file descriptor, or to the capture buffer if
+ *              output is captured, and empties the buffer. Write errors
+ *              (a closed pipe, for example) discard the output, as
+ *              putchar did.
+ */
+static void flush_output(UM um)
+{
+        unsigned char *p = um->out_buf;
+        size_t left = um->out_length;
+        ssize_t n;
+
+        if (um->out_fd < 0 && left > 0) {
+                capture_output(um);
+                left = 0;
+        }
+        while (left > 0) {
+                n = write(um->out_fd, p, left);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        break;
+                p += n;
+                left -= (size_t) n;
+        }
+        um->out_length = 0;
+}
+
+/* interval_expired() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     true if the oldest buffered byte has waited longer than
+ *              the flush interval: bool type
+ *
+ * Purpose:     Checks the flush interval of a UM whose buffer is not
+ *              empty.
+ */
+static bool interval_expired(UM um)
+{
+        struct timespec now;
+        long elapsed_ms;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ms = (now.tv_sec - um->first_output.tv_sec) * 1000 +
+                (now.tv_nsec - um->first_output.tv_nsec) / 1000000;
+        return elapsed_ms >= (long) um->flush_interval_ms;
+}
+
+/* output_char() function
+ * Parameters:  um: UM type; c: Word type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Appends the low byte of c to the given UM's output buffer,
+ *              flushing the buffer when it is full or when the flush
+ *              interval has passed.
+ */
+static inline void output_char(UM um, Word c)
+{
+        if (um->flush_interval_ms != 0) {
+                if (um->out_length == 0)
+                        clock_gettime(CLOCK_MONOTONIC, &um->first_output);
+                else if (interval_expired(um))
+                        flush_output(um);
+        }
+        um->out_buf[um->out_length++] = (unsigned char) c;
+        if (um->out_length == OUT_BUF_SIZE)
+                flush_output(um);
+}
+
+/* snapshot_at_input() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Takes the snapshot requested with UM_set_snapshot() when
+ *              the first IN runs. The snapshot resumes at the IN itself,
+ *              so the restored UM reads its own input.
+ */
+static void snapshot_at_input(UM um)
+{
+        const char *path = um->snapshot_path;
+
+        um->snapshot_path = NULL;
+        um->counter--;
+        if (!UM_snapshot(um, path))
+                fprintf(stderr, "Could not write snapshot %s\n", path);
+        um->counter++;
+}
+
+/* input_char() function
+ * Parameters:  um: UM type; c: Word * type
+ *
+ * Returns:     false if no input is ready and the UM may not block: bool
+ *
+ * Purpose:     Reads one byte of the UM's input for IN into *c, or
+ *              EOF_FLAG at end of input. If the read would block, pending
+ *              output is flushed first so that prompts appear before the
+ *              UM waits for the answer. The program counter must already
+ *              be past the IN.
+ */
+static inline bool input_char(UM um, Word *c)
+{
+        int in;
+
+        if (um->snapshot_path != NULL)
+                snapshot_at_input(um);
+        if (um->input->next == um->input->end &&
+            !UMInput_ready(um->input)) {
+                flush_output(um);
+                if (!um->blocking)
+                        return false;
+        }
+        in = UMInput_get(um->input);
+        *c = in < 0 ? (Word) EOF_FLAG : (Word) in;
+        return true;
+}
+
+/* init_output() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Sets up the output buffer of a new UM.
+ */
+static void init_output(UM um)
+{
+        um->out_fd = STDOUT_FILENO;
+        um->capture = NULL;
+        um->capture_length = um->capture_size = 0;
+        um->flush_interval_ms = 0;
+        um->out_length = 0;
+}
+
+/* new_um() function
+ * Parameters:  registers: Register * type; segments: Segments type;
+ *              input: UM_input type; counter: uint32_t type
+ *
+ * Returns:     A new UM that owns the given state, with no decoded
+ *              cache yet: UM type
+ *
+ * Purpose:     Sets up everything UM_new() and UM_new_from() have in
+ *              common; the caller fills segment 0's decoded cache.
+ */
+static UM new_um(Register *registers, Segments segments, UM_input input,
+                 uint32_t counter)
+{
+        UM um = malloc(sizeof(struct UM));
+        um->registers = registers;
+        um->segments = segments;
+        um->counter = counter;
+        um->decoded = NULL;
+        um->decoded_length = 0;
+        um->decoded_mapped = 0;
+        um->engine = UM_DEFAULT_ENGINE;
+        um->jit = NULL;
+        um->profile = NULL;
+        um->snapshot_path = NULL;
+        um->stopped = um->finished = false;
+        um->hosted_input = false;
+        um->input = input;
+        init_output(um);
+        return um;
+}
+
+/* stop() function
+ * Parameters:  um: UM type; status: UM_status type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Makes the running engine return with the given status.
+ *              A halted or failed UM stays that way.
+ */
+static void stop(UM um, UM_status status)
+{
+        um->status = status;
+        um->stopped = true;
+        um->finished = status == UM_HALTED || status == UM_FAULT;
+}
+
 /* UM_execute() function
  * Parameters:  um: UM type; instr: Instructions type
  *
- * Returns:     void
+ * Returns:     false if the instruction stopped the UM: bool type
  *
  * Purpose:     Executes the UM instruction detailed by the fields of the 
- *              given Instructions struct on the given UM. 
+ *              given Instructions struct on the given UM. An IN that
+ *              cannot read, a division by zero or an invalid opcode
+ *              leaves the program counter on the instruction.
  */
-static inline void UM_execute(UM um, Instructions instr)
+static inline bool UM_execute(UM um, Instructions instr)
 {
-        char in;
         Word load_word;
-        Um_register ra = instr.ra, rb = instr.rb, rc = instr.rc;
-        Um_register lv_ra = instr.lv_ra;
-        Word lv_val = instr.lv_val;
-        Word a_val = um->registers[ra];
-                //UMRegister_get(um->registers, ra);
-        Word b_val = um->registers[rb];
-                //UMRegister_get(um->registers, rb);
-        Word c_val = um->registers[rc];
-                //UMRegister_get(um->registers, rc);
-
-        Word *a_valp = &(um->registers[ra]);
-        Word *b_valp = &(um->registers[rb]);
-        Word *c_valp = &(um->registers[rc]);
-
-        Segments segments = um->segments;
-        UArray_T curr_segment;
-        Word *word;
-        UArray_T src_segment, dest_segment;
+        Um_register ra, rb, rc;
+        Word lv_val, a_val, b_val, c_val;
+        Word *a_valp, *b_valp, *c_valp;
+        Word **seg_array;
+        uint8_t rest;
+
+dispatch:
+        ra = instr.ra;
+        rb = instr.rb;
+        rc = instr.rc;
+        lv_val = instr.lv_val;
+        a_val = um->registers[ra];
+        b_val = um->registers[rb];
+        c_val = um->registers[rc];
+
+        a_valp = &(um->registers[ra]);
+        b_valp = &(um->registers[rb]);
+        c_valp = &(um->registers[rc]);
+
+        seg_array = um->segments->seg_array;
 
         switch (instr.op) {
                 case CMOV:
                         if (c_val == 0)
-                                return;
+                                return true;
                         *a_valp = *b_valp;
-                        //UMRegister_move(um->registers, ra, rb);
                         break;
                 case SLOAD:
-                        curr_segment = Seq_get((segments->seg_array), b_val);
-                        load_word = *(uint32_t *)(curr_segment->elems + (c_val * curr_segment->size));
-                        //load_word = UMSegment_at(um->segments, b_val, c_val);
+                        load_word = seg_array[b_val][c_val];
                         *a_valp = load_word;
-                        //UMRegister_put(um->registers, ra, load_word);
                         break;
                 case SSTORE:
-                        curr_segment = Seq_get(segments->seg_array, a_val);
-                        word = (uint32_t *)(curr_segment->elems + (b_val * curr_segment->size));
-                        *word = c_val;
-                        //UMSegment_insert(um->segments, a_val, b_val, c_val);
+                        UMSegment_writable(um->segments, a_val)[b_val] = c_val;
+                        if (a_val == CODE_SEG)
+                                invalidate_decoded(um, b_val, b_val + 1);
                         break;
                 case ADD: 
                         *a_valp = *b_valp + *c_valp;
-                        //UMRegister_add(um->registers, ra, rb, rc);
                         break;
                 case MUL: 
                         *a_valp = *b_valp * *c_valp;
-                        //UMRegister_mult(um->registers, ra, rb, rc);
                         break;
                 case DIV:
+                        if (c_val == 0) {
+                                um->counter--;
+                                stop(um, UM_FAULT);
+                                return false;
+                        }
                         *a_valp = *b_valp / *c_valp;
-                        //UMRegister_div(um->registers, ra, rb, rc);
                         break;
                 case NAND:
                         *a_valp = ~(*b_valp & *c_valp);
-                        //UMRegister_nand(um->registers, ra, rb, rc);
                         break;
                 case HALT:
-                        UM_free(um);
-                        exit(EXIT_SUCCESS);
-                        break;
+                        stop(um, UM_HALTED);
+                        return false;
                 case MAP: 
                         UMSegment_map(um->segments, c_val, um->registers, rb);
                         break;
@@ -285,37 +793,420 @@ static inline void UM_execute(UM um, Instructions instr)
                         UMSegment_unmap(um->segments, c_val);
                         break;
                 case OUT:
-                        putchar((unsigned char) c_val);
+                        output_char(um, c_val);
                         break;
                 case IN: 
-                        in = getchar();
-                        fflush(NULL);
-                        if (in == EOF)
-                                in = EOF_FLAG;
-                        *c_valp = in;
-                        //UMRegister_put(um->registers, rc, in);
+                        if (!input_char(um, c_valp)) {
+                                um->counter--;
+                                stop(um, UM_BLOCKED);
+                                return false;
+                        }
                         break;
                 case LOADP:
-                        if (b_val != CODE_SEG) {
-                                src_segment = Seq_get(segments->seg_array, b_val);
-                                dest_segment = Seq_get(segments->seg_array, CODE_SEG);
-                                UArray_free(&dest_segment);
-                                Seq_put(segments->seg_array, CODE_SEG, NULL);
-                                dest_segment = UArray_copy(src_segment, 
-                                                           UArray_length(src_segment));
-                                Seq_put(segments->seg_array, CODE_SEG, dest_segment);
-                              
-                                //UMSegment_copy(um->segments, b_val, CODE_SEG);
-                        }
+                        if (b_val != CODE_SEG)
+                                load_program(um, b_val);
                         um->counter = c_val;
                         break;
                 case LV:
-                        um->registers[lv_ra] = lv_val;
-                        //UMRegister_put(um->registers, lv_ra, lv_val);
+                        um->registers[ra] = lv_val;
                         break;
+                case LV_SLOAD:
+                case LV_SSTORE:
+                case LV_ADD:
+                case LV_NAND:
+                case LV_LV:
+                case LV_LV_NAND:
+                        um->registers[ra] = lv_val;
+                        goto next_part;
+                case CMOV_LOADP:
+                        if (c_val != 0)
+                                *a_valp = *b_valp;
+                        goto next_part;
+                default:
+                        um->counter--;
+                        stop(um, UM_FAULT);
+                        return false;
                 }
+        return true;
+
+        /* The first instruction of a fusion is done: run the rest of it,
+         * starting with the next word, without returning to the loop. */
+next_part:
+        rest = fusion_rest[instr.op];
+        instr = um->decoded[um->counter++];
+        instr.op = rest;
+        goto dispatch;
+}
+
+/* step() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     false if the instruction stopped the UM: bool type
+ *
+ * Purpose:     Runs the single instruction at the program counter, which
+ *              must be in segment 0. A fusion stored there is split, so
+ *              only its first instruction runs.
+ */
+static bool step(UM um)
+{
+        Instructions curr_instr = um->decoded[um->counter];
+
+        curr_instr.op = fusion_first[curr_instr.op];
+        um->counter++;
+        return UM_execute(um, curr_instr);
+}
+
+/* run_switch() function
+ * Parameters:  um: UM type; left: instruction budget: uint64_t type
+ *
+ * Returns:     What is left of the budget: uint64_t type
+ *
+ * Purpose:     The portable engine. In each iteration of the loop, picks
+ *              up the next pre-decoded UM instruction in the loaded
+ *              program, executes it, and moves to the next instruction.
+ *              Returns when the UM stops, when the program counter leaves
+ *              segment 0, or when fewer than MAX_FUSED instructions are
+ *              left in the budget. UM_run does not count instructions, so an
+ *              unlimited budget gets its own loop.
+ */
+static uint64_t run_switch(UM um, uint64_t left)
+{
+        Instructions curr_instr;
+
+        if (left == UNLIMITED) {
+                while (um->counter < um->decoded_length) {
+                        curr_instr = um->decoded[um->counter];
+                        um->counter++;
+                        if (!UM_execute(um, curr_instr))
+                                break;
+                }
+                return left;
+        }
+        while (um->counter < um->decoded_length && left >= MAX_FUSED) {
+                curr_instr = um->decoded[um->counter];
+                um->counter++;
+                left -= fusion_length[curr_instr.op];
+                if (!UM_execute(um, curr_instr))
+                        break;
+        }
+        return left;
+}
+
+/* finish_profile() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes the report of the given UM's profile, if it has
+ *              one, and frees the profile, closing its stream.
+ */
+static void finish_profile(UM um)
+{
+        if (um->profile == NULL)
+                return;
+        UMProfile_report(um->profile, code_words(um), um->decoded_length);
+        UMProfile_free(um->profile);
+        um->profile = NULL;
+}
+
+/* run_profiled() function
+ * Parameters:  um: UM type; left: instruction budget: uint64_t type
+ *
+ * Returns:     What is left of the budget: uint64_t type
+ *
+ * Purpose:     Runs the given UM one instruction at a time, counting
+ *              every instruction by opcode and program counter and every
+ *              LOADP by target. Fusions are split back into single
+ *              instructions so the counts are exact. Used instead of the
+ *              configured engine when profiling; returns when the UM
+ *              stops, when the program counter leaves segment 0, or when
+ *              the budget runs out. An IN that has to be retried is
+ *              counted again.
+ */
+static uint64_t run_profiled(UM um, uint64_t left)
+{
+        UM_profile profile = um->profile;
+        uint32_t pc;
+        uint8_t op;
+
+        for (; left > 0 && um->counter < um->decoded_length; left--) {
+                pc = um->counter;
+                op = fusion_first[um->decoded[pc].op];
+                profile->pc_counts[pc]++;
+                profile->op_counts[op]++;
+                if (!step(um))
+                        break;
+                if (op == LOADP && um->counter < um->decoded_length)
+                        profile->loadp_counts[um->counter]++;
+        }
+        return left;
+}
+
+#ifdef __GNUC__
+
+/* The threaded engine relies on the GCC labels-as-values extension, which
+ * -pedantic would otherwise reject. Other compilers run the switch engine
+ * in its place.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+/* run_threaded() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Runs the given UM with threaded dispatch. Every opcode has
+ *              its own handler which reads only the registers it uses and
+ *              ends with its own indirect jump to the handler of the next
+ *              pre-decoded instruction, so the branch predictor sees one
+ *              jump site per opcode instead of a single shared switch.
+ *              Fused instructions chain to the next handler directly.
+ *              Returns, with what is left of the budget 'left', under
+ *              the same conditions as run_switch(). Handlers specialized
+ *              on their register operands were tried in place of these
+ *              and ran slower: GCC kept the registers in stack slots all
+ *              the same, and the thousands of handlers took minutes to
+ *              compile.
+ */
+static uint64_t run_threaded(UM um, uint64_t left)
+{
+        static void *const handlers[NUM_OPCODES] = {
+                &&do_cmov, &&do_sload, &&do_sstore, &&do_add, &&do_mul,
+                &&do_div, &&do_nand, &&do_halt, &&do_map, &&do_unmap,
+                &&do_out, &&do_in, &&do_loadp, &&do_lv, &&do_invalid,
+                &&do_invalid,
+                &&do_lv_sload, &&do_lv_sstore, &&do_lv_add, &&do_lv_nand,
+                &&do_lv_lv, &&do_lv_lv_nand, &&do_cmov_loadp
+        };
+        Word *regs = um->registers;
+        Instructions *code = um->decoded;
+        uint32_t length = um->decoded_length;
+        uint32_t pc = um->counter;
+        Instructions instr;
+        Word **seg_array;
+        Word b_val;
+
+#define DISPATCH()                                                      \
+        do {                                                            \
+                if (pc >= length || left < MAX_FUSED)                   \
+                        goto done;                                      \
+                left--;                                                 \
+                instr = code[pc++];                                     \
+                goto *handlers[instr.op];                               \
+        } while (0)
+
+        DISPATCH();
+
+do_cmov:
+        if (regs[instr.rc] != 0)
+                regs[instr.ra] = regs[instr.rb];
+        DISPATCH();
+do_sload:
+        seg_array = um->segments->seg_array;
+        regs[instr.ra] = seg_array[regs[instr.rb]][regs[instr.rc]];
+        DISPATCH();
+do_sstore:
+        UMSegment_writable(um->segments, regs[instr.ra])[regs[instr.rb]] =
+                regs[instr.rc];
+        if (regs[instr.ra] == CODE_SEG)
+                invalidate_decoded(um, regs[instr.rb], regs[instr.rb] + 1);
+        DISPATCH();
+do_add:
+        regs[instr.ra] = regs[instr.rb] + regs[instr.rc];
+        DISPATCH();
+do_mul:
+        regs[instr.ra] = regs[instr.rb] * regs[instr.rc];
+        DISPATCH();
+do_div:
+        if (regs[instr.rc] == 0)
+                goto fault;
+        regs[instr.ra] = regs[instr.rb] / regs[instr.rc];
+        DISPATCH();
+do_nand:
+        regs[instr.ra] = ~(regs[instr.rb] & regs[instr.rc]);
+        DISPATCH();
+do_halt:
+        stop(um, UM_HALTED);
+        goto done;
+do_map:
+        UMSegment_map(um->segments, regs[instr.rc], regs, instr.rb);
+        DISPATCH();
+do_unmap:
+        UMSegment_unmap(um->segments, regs[instr.rc]);
+        DISPATCH();
+do_out:
+        output_char(um, regs[instr.rc]);
+        DISPATCH();
+do_in:
+        um->counter = pc;
+        if (!input_char(um, &regs[instr.rc])) {
+                pc--;
+                stop(um, UM_BLOCKED);
+                goto done;
+        }
+        DISPATCH();
+do_loadp:
+        b_val = regs[instr.rb];
+        pc = regs[instr.rc];
+        if (b_val != CODE_SEG) {
+                load_program(um, b_val);
+                code = um->decoded;
+                length = um->decoded_length;
+        }
+        DISPATCH();
+do_lv:
+        regs[instr.ra] = instr.lv_val;
+        DISPATCH();
+do_invalid:
+        goto fault;
+
+        /* Fused handlers run their first instruction and go straight to
+         * the handler of the next one, skipping the indirect jump. Each
+         * instruction is taken from the budget as it runs. */
+do_lv_sload:
+        regs[instr.ra] = instr.lv_val;
+        left--;
+        instr = code[pc++];
+        goto do_sload;
+do_lv_sstore:
+        regs[instr.ra] = instr.lv_val;
+        left--;
+        instr = code[pc++];
+        goto do_sstore;
+do_lv_add:
+        regs[instr.ra] = instr.lv_val;
+        left--;
+        instr = code[pc++];
+        goto do_add;
+do_lv_nand:
+        regs[instr.ra] = instr.lv_val;
+        left--;
+        instr = code[pc++];
+        goto do_nand;
+do_lv_lv:
+        regs[instr.ra] = instr.lv_val;
+        left--;
+        instr = code[pc++];
+        goto do_lv;
+do_lv_lv_nand:
+        regs[instr.ra] = instr.lv_val;
+        left--;
+        instr = code[pc++];
+        goto do_lv_nand;
+do_cmov_loadp:
+        if (regs[instr.rc] != 0)
+                regs[instr.ra] = regs[instr.rb];
+        left--;
+        instr = code[pc++];
+        goto do_loadp;
+
+#undef DISPATCH
+
+fault:
+        pc--;
+        stop(um, UM_FAULT);
+done:
+        um->counter = pc;
+        return left;
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+static uint64_t run_threaded(UM um, uint64_t left)
+{
+        return run_switch(um, left);
 }
 
+#endif /* __GNUC__ */
+
+/* jit_sstore(), jit_unmap(), jit_output() functions
+ * Parameters:  ctx: the UM running the block; UM register values
+ *
+ * Purpose:     Helpers called from JIT translated code for the stores it
+ *              does not make itself and for the output instructions.
+ *              jit_sstore() returns nonzero when its write into segment 0
+ *              dropped a translation, which ends the running block.
+ */
+static int jit_sstore(void *ctx, Word seg, Word address, Word value)
+{
+        UM um = ctx;
+        UMSegment_writable(um->segments, seg)[address] = value;
+        if (seg != CODE_SEG)
+                return 0;
+        return invalidate_decoded(um, address, address + 1);
+}
+
+static void jit_unmap(void *ctx, Word seg)
+{
+        UM um = ctx;
+        UMSegment_unmap(um->segments, seg);
+}
+
+static void jit_output(void *ctx, Word c)
+{
+        output_char(ctx, c);
+}
+
+/* run_jit() function
+ * Parameters:  um: UM type; left: instruction budget: uint64_t type
+ *
+ * Returns:     What is left of the budget: uint64_t type
+ *
+ * Purpose:     Runs the given UM with the JIT. Translated blocks are
+ *              called whenever one exists for the program counter; the
+ *              instructions the JIT leaves out, and LOADPs that replace
+ *              segment 0, are run one at a time by UM_execute(). A block
+ *              that stops at such a LOADP returns its program counter, so
+ *              it is checked before looking up a block, and so is a
+ *              DIV by zero, which a block leaves at once. A block is only
+ *              called if the budget covers every instruction in it, and
+ *              is charged for the instructions it ran, so the budget is
+ *              exact as for the other engines. Falls back to plain
+ *              interpretation when no executable memory is available.
+ *              Returns under the same conditions as run_switch().
+ */
+static uint64_t run_jit(UM um, uint64_t left)
+{
+        UMJit_helpers helpers = {
+                &um->segments->seg_array, jit_sstore, jit_unmap, jit_output
+        };
+        UMJit_block block;
+        Instructions curr_instr;
+        uint64_t result;
+        uint32_t size;
+
+        if (um->jit == NULL) {
+                um->jit = UMJit_new(helpers);
+                if (um->jit != NULL)
+                        UMJit_reset(um->jit, um->decoded_length);
+        }
+
+        while (um->counter < um->decoded_length && left >= MAX_FUSED) {
+                curr_instr = um->decoded[um->counter];
+                if (um->jit != NULL && (curr_instr.op != LOADP ||
+                    um->registers[curr_instr.rb] == CODE_SEG) &&
+                    (curr_instr.op != DIV ||
+                     um->registers[curr_instr.rc] != 0)) {
+                        block = UMJit_lookup(um->jit, code_words(um),
+                                             um->counter);
+                        size = UMJit_length(um->jit, um->counter);
+                        if (block != NULL && size <= left) {
+                                result = block(um->registers, um);
+                                um->counter = UMJIT_PC(result);
+                                left -= UMJIT_COUNT(result);
+                                continue;
+                        }
+                }
+                um->counter++;
+                left -= fusion_length[curr_instr.op];
+                if (!UM_execute(um, curr_instr))
+                        break;
+        }
+        return left;
+}
 
 /*******************************************************
  *
@@ -334,48 +1225,463 @@ static inline void UM_execute(UM um, Instructions instr)
  */
 UM UM_new(char *program)
 {
-        UM um = malloc(sizeof(struct UM));
-        um->registers = UMRegister_new();
-        um->segments = UMSegment_new();
-        um->counter = 0;
+        UM um = new_um(UMRegister_new(), UMSegment_new(),
+                       UMInput_new(STDIN_FILENO), 0);
+
         read_program(um, program);
         return um;
 }
 
+/* UM_new_from() function
+ * Parameters:  registers: Register * type; segments: Segments type;
+ *              input: UM_input type; counter: uint32_t type
+ *
+ * Returns:     Initialized UM
+ *
+ * Purpose:     Initializes a new UM from existing machine state. The UM
+ *              takes ownership of the given registers, segments and input
+ *              and will continue at program counter 'counter' of segment
+ *              0. Programs translated with um2c make their UM this way
+ *              before they start, so that their output goes through it.
+ */
+UM UM_new_from(Register *registers, Segments segments, UM_input input,
+               uint32_t counter)
+{
+        UM um = new_um(registers, segments, input, counter);
+
+        fflush(stdout);
+        rebuild_decoded(um);
+        return um;
+}
+
+/* UM_resume_at() function
+ * Parameters:  um: UM type; counter: uint32_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Moves the program counter of the given UM to 'counter' and
+ *              decodes segment 0 again, as it may have been changed
+ *              without the UM seeing it. Used by programs translated with
+ *              um2c to hand execution back to the interpreter.
+ */
+void UM_resume_at(UM um, uint32_t counter)
+{
+        um->counter = counter;
+        rebuild_decoded(um);
+}
+
+/* UM_restore() function
+ * Parameters:  snapshot: const char * type
+ *
+ * Returns:     Initialized UM
+ *
+ * Purpose:     Initializes a new UM from the snapshot file with filename
+ *              'snapshot', reading from standard input. The UM continues
+ *              where the snapshot was taken.
+ */
+UM UM_restore(const char *snapshot)
+{
+        Register *registers = UMRegister_new();
+        Segments segments;
+        uint32_t counter;
+
+        segments = UMSnapshot_read(snapshot, registers, &counter);
+        return UM_new_from(registers, segments, UMInput_new(STDIN_FILENO),
+                           counter);
+}
+
 /* UM_free() function
  * Parameters:  um: UM type
  *
  * Returns:     void
  *
  * Purpose:     Frees any allocated memory associated with the given UM.
+ *              Pending output is flushed first, and a UM freed before it
+ *              halted still writes its profile report.
  */
 void UM_free(UM um)
 {
+        flush_output(um);
+        finish_profile(um);
         UMRegister_free(um->registers);
         UMSegment_free(um->segments);
+        free_decoded(um);
+        UMJit_free(um->jit);
+        UMInput_free(um->input);
+        free(um->capture);
         free(um);
 }
 
-/* UM_run() function
+/* UM_set_flush_interval() function
+ * Parameters:  um: UM type; interval_ms: unsigned type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Bounds how long output may wait in the given UM's buffer:
+ *              an OUT that finds the oldest buffered byte at least
+ *              interval_ms milliseconds old flushes the buffer. 0 (the
+ *              default) flushes only when needed.
+ */
+void UM_set_flush_interval(UM um, unsigned interval_ms)
+{
+        um->flush_interval_ms = interval_ms;
+}
+
+/* UM_set_output() function
+ * Parameters:  um: UM type; fd: int type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Makes the given UM write its output to file descriptor fd
+ *              instead of standard output. Output already buffered goes
+ *              to the old descriptor. The UM does not close fd.
+ */
+void UM_set_output(UM um, int fd)
+{
+        flush_output(um);
+        um->out_fd = fd;
+}
+
+/* UM_capture_output() function
  * Parameters:  um: UM type
  *
  * Returns:     void
  *
- * Purpose:     'Runs' the UM with a main instruction loop. In each 
- *              iteration of the loop, picks up the next UM instruction in 
- *              the loaded program, executes it, and moves to the next 
- *              instruction. 
+ * Purpose:     Makes the given UM keep its output in memory instead of
+ *              writing it to a file descriptor. The output is collected
+ *              with UM_take_output().
  */
-void UM_run(UM um)
+void UM_capture_output(UM um)
 {
-        Instructions curr_instr = unpack_instruction(um);
-        int code_length = UMSegment_length(um->segments, CODE_SEG);
+        flush_output(um);
+        um->out_fd = -1;
+}
 
-        while (curr_instr.op != HALT || (int) um->counter < code_length) {
-                curr_instr = unpack_instruction(um);
-                um->counter++;
-                UM_execute(um, curr_instr);
+/* UM_take_output() function
+ * Parameters:  um: UM type; length: size_t * type
+ *
+ * Returns:     The output captured so far, or NULL if there is none:
+ *              unsigned char * type
+ *
+ * Purpose:     Hands the given UM's captured output to the caller, who
+ *              must free it, and stores its length in *length. Capturing
+ *              starts again with an empty buffer.
+ */
+unsigned char *UM_take_output(UM um, size_t *length)
+{
+        unsigned char *output;
+
+        flush_output(um);
+        output = um->capture;
+        *length = um->capture_length;
+        um->capture = NULL;
+        um->capture_length = um->capture_size = 0;
+        return output;
+}
+
+/* UM_set_host_input() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Makes the given UM read its input from bytes pushed with
+ *              UM_push_input() instead of standard input, which lets one
+ *              thread run many interactive UMs. An IN that finds no
+ *              pushed input left stops the UM with UM_BLOCKED, even in
+ *              UM_run(); the host pushes more input, or closes it, and
+ *              runs the UM again to retry the IN. Must be called before
+ *              the UM first runs.
+ */
+void UM_set_host_input(UM um)
+{
+        UMInput_free(um->input);
+        um->input = UMInput_new_hosted();
+        um->hosted_input = true;
+}
+
+/* UM_push_input() function
+ * Parameters:  um: UM type; bytes: const void * type; length: size_t
+ *
+ * Returns:     void
+ *
+ * Purpose:     Appends input for a UM set up with UM_set_host_input().
+ *              The bytes are copied.
+ */
+void UM_push_input(UM um, const void *bytes, size_t length)
+{
+        UMInput_push(um->input, bytes, length);
+}
+
+/* UM_close_input() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Ends the input of a UM set up with UM_set_host_input().
+ *              Once the pushed bytes are read, IN reads end of input
+ *              instead of blocking.
+ */
+void UM_close_input(UM um)
+{
+        UMInput_close(um->input);
+}
+
+/* UM_out() function
+ * Parameters:  um: UM type; c: Word type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes the low byte of c as OUT does, through the given
+ *              UM's output buffer. Used by programs translated with um2c.
+ */
+void UM_out(UM um, Word c)
+{
+        output_char(um, c);
+}
+
+/* UM_in() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     The next byte of input, or EOF_FLAG at end of input: Word
+ *
+ * Purpose:     Reads input as IN does, flushing pending output before
+ *              waiting for it. Used by programs translated with um2c, on
+ *              UMs that read their own input.
+ */
+Word UM_in(UM um)
+{
+        Word c = EOF_FLAG;
+
+        um->blocking = true;
+        input_char(um, &c);
+        return c;
+}
+
+/* UM_set_profile() function
+ * Parameters:  um: UM type; report: FILE * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Makes UM_run() profile the given UM instead of running its
+ *              usual engine. The sorted report is written to the given
+ *              stream when the UM halts, and the UM takes ownership of
+ *              the stream.
+ */
+void UM_set_profile(UM um, FILE *report)
+{
+        um->profile = UMProfile_new(report);
+        UMProfile_resize(um->profile, um->decoded_length);
+}
+
+/* UM_set_engine() function
+ * Parameters:  um: UM type; engine: UM_engine type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Makes UM_run() and UM_run_for() run the given UM with the
+ *              given engine: the portable switch loop, threaded dispatch
+ *              or the JIT. The engine can be changed between runs.
+ */
+void UM_set_engine(UM um, UM_engine engine)
+{
+        um->engine = engine;
+}
+
+/* UM_share_images() function
+ * Parameters:  share: bool type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Turns the program image cache (see Um_image.h) on or off
+ *              for the UMs created from then on. It is off by default:
+ *              a single UM loads its program straight from the file, and
+ *              hosts that run many UMs of the same programs turn the
+ *              cache on so that those UMs share one copy of each.
+ */
+void UM_share_images(bool share)
+{
+        share_images = share;
+}
+
+/* UM_default_engine() function
+ * Parameters:  none
+ *
+ * Returns:     The engine new UMs run with, chosen with ENGINE when the
+ *              UM is built: UM_engine type
+ */
+UM_engine UM_default_engine(void)
+{
+        return UM_DEFAULT_ENGINE;
+}
+
+/* UM_engine_named() function
+ * Parameters:  name: const char * type; engine: UM_engine * type
+ *
+ * Returns:     true if name is the name of an engine, which is stored in
+ *              *engine: bool type
+ */
+bool UM_engine_named(const char *name, UM_engine *engine)
+{
+        int i;
+
+        for (i = 0; i < UM_NUM_ENGINES; i++) {
+                if (strcmp(name, engine_names[i]) == 0) {
+                        *engine = (UM_engine) i;
+                        return true;
+                }
+        }
+        return false;
+}
+
+/* UM_engine_name() function
+ * Parameters:  engine: UM_engine type
+ *
+ * Returns:     The name of the given engine: const char * type
+ */
+const char *UM_engine_name(UM_engine engine)
+{
+        return engine_names[engine];
+}
+
+/* UM_set_snapshot() function
+ * Parameters:  um: UM type; path: const char * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Makes the given UM write a snapshot to the file at path
+ *              just before its first IN reads any input, then carry on.
+ *              The path must stay valid until then.
+ */
+void UM_set_snapshot(UM um, const char *path)
+{
+        um->snapshot_path = path;
+}
+
+/* UM_snapshot() function
+ * Parameters:  um: UM type; path: const char * type
+ *
+ * Returns:     true if the snapshot was written: bool type
+ *
+ * Purpose:     Writes a snapshot of the given UM, which resumes at its
+ *              current program counter, to the file at path. Pending
+ *              output is flushed first.
+ */
+bool UM_snapshot(UM um, const char *path)
+{
+        flush_output(um);
+        return UMSnapshot_write(path, um->registers, um->segments,
+                                um->counter);
+}
+
+/* run() function
+ * Parameters:  um: UM type; budget: uint64_t type; blocking: bool type
+ *
+ * Returns:     Why the UM stopped: UM_status type
+ *
+ * Purpose:     Runs the given UM for at most 'budget' instructions with
+ *              its engine, or with the profiler if profiling.
+ *              IN waits for input if 'blocking' is true, and otherwise
+ *              stops the UM when no input is ready. Output is flushed,
+ *              and the profile report written, once the UM halts or
+ *              fails.
+ */
+static UM_status run(UM um, uint64_t budget, bool blocking)
+{
+        uint64_t left;
+
+        if (um->finished)
+                return um->status;
+        um->stopped = false;
+        um->blocking = blocking && !um->hosted_input;
+        if (um->profile != NULL)
+                left = run_profiled(um, budget);
+        else if (um->engine == UM_ENGINE_THREADED)
+                left = run_threaded(um, budget);
+        else if (um->engine == UM_ENGINE_JIT)
+                left = run_jit(um, budget);
+        else
+                left = run_switch(um, budget);
+        for (; !um->stopped && left > 0 &&
+               um->counter < um->decoded_length; left--)
+                step(um);
+
+        if (!um->stopped && um->counter >= um->decoded_length)
+                stop(um, UM_FAULT);
+        else if (!um->stopped)
+                um->status = UM_BUDGET;
+        if (um->finished) {
+                flush_output(um);
+                finish_profile(um);
         }
-        UM_free(um);
-        exit(EXIT_SUCCESS);
+        return um->status;
+}
+
+/* UM_run() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     UM_HALTED or UM_FAULT, or UM_BLOCKED for host input:
+ *              UM_status type
+ *
+ * Purpose:     Runs the given UM until it halts or fails, waiting for
+ *              input whenever IN needs it (except for host input; see
+ *              UM_set_host_input()), with the engine picked by
+ *              UM_set_engine(). A profiled UM always runs in
+ *              run_profiled(). The UM is not freed.
+ */
+UM_status UM_run(UM um)
+{
+        return run(um, UNLIMITED, true);
+}
+
+/* UM_run_for() function
+ * Parameters:  um: UM type; max_instructions: uint64_t type
+ *
+ * Returns:     Why the UM stopped: UM_status type
+ *
+ * Purpose:     Runs the given UM for at most max_instructions
+ *              instructions and returns with its state intact. Returns
+ *              UM_HALTED after HALT, UM_FAULT if the program failed (see
+ *              UM_counter()), UM_BLOCKED if IN found no input ready, and
+ *              UM_BUDGET if the budget ran out. A blocked UM retries the
+ *              IN when it is run again; a halted or failed UM does not
+ *              run again.
+ */
+UM_status UM_run_for(UM um, uint64_t max_instructions)
+{
+        return run(um, max_instructions, false);
+}
+
+/* UM_counter() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     The program counter of the given UM: uint32_t type
+ *
+ * Purpose:     After a fault, this is the instruction that failed, or an
+ *              address past the end of segment 0 if the program ran off
+ *              the end or jumped out of it.
+ */
+uint32_t UM_counter(UM um)
+{
+        return um->counter;
+}
+
+/* UM_registers() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     The eight registers of the given UM: const Word * type
+ */
+const Word *UM_registers(UM um)
+{
+        return um->registers;
+}
+
+/* UM_segments() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     The segment table of the given UM, for inspection only:
+ *              Segments type
+ */
+Segments UM_segments(UM um)
+{
+        return um->segments;
 }
@@ -15,16 +15,52 @@
 #ifndef UM_H
 #define UM_H
 
-//#include "Um_segments.h"
-//#include "Um_registers.h"
 #include "Um_instructions.h"
+#include "Um_input.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 typedef struct UM *UM;
 
+/* Why UM_run() or UM_run_for() returned */
+typedef enum UM_status {
+        UM_HALTED, UM_BLOCKED, UM_BUDGET, UM_FAULT
+} UM_status;
+
+/* The engines that can run a UM; see UM_set_engine() */
+typedef enum UM_engine {
+        UM_ENGINE_SWITCH, UM_ENGINE_THREADED, UM_ENGINE_JIT,
+        UM_NUM_ENGINES
+} UM_engine;
+
 UM UM_new(char *program);
+UM UM_new_from(Register *registers, Segments segments, UM_input input,
+               uint32_t counter);
+void UM_resume_at(UM um, uint32_t counter);
+UM UM_restore(const char *snapshot);
 void UM_free(UM um);
-void UM_run(UM um);
+void UM_set_flush_interval(UM um, unsigned interval_ms);
+void UM_set_output(UM um, int fd);
+void UM_capture_output(UM um);
+unsigned char *UM_take_output(UM um, size_t *length);
+void UM_set_host_input(UM um);
+void UM_push_input(UM um, const void *bytes, size_t length);
+void UM_close_input(UM um);
+void UM_out(UM um, Word c);
+Word UM_in(UM um);
+void UM_set_profile(UM um, FILE *report);
+void UM_set_engine(UM um, UM_engine engine);
+void UM_share_images(bool share);
+UM_engine UM_default_engine(void);
+bool UM_engine_named(const char *name, UM_engine *engine);
+const char *UM_engine_name(UM_engine engine);
+void UM_set_snapshot(UM um, const char *path);
+bool UM_snapshot(UM um, const char *path);
+UM_status UM_run(UM um);
+UM_status UM_run_for(UM um, uint64_t max_instructions);
+uint32_t UM_counter(UM um);
+const Word *UM_registers(UM um);
+Segments UM_segments(UM um);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,521 @@
+/*******************************************************
+ *
+ *      Um_image.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_image.c contains the implementation of the UM program image
+ *      cache.
+ *
+ *      Opening a program reads the file and hashes its raw words; an
+ *      image with the same hash and length is only reused after its
+ *      words are compared, so a collision costs a load but never runs
+ *      the wrong program. A new image is byte-swapped, behind a segment
+ *      header, into an anonymous memory file (memfd); the first UM to
+ *      decode it stores the decoded form in a second one. UMs map these
+ *      files MAP_PRIVATE, so the kernel shares their pages and copies a
+ *      page only when a UM writes to it. Images are never changed once
+ *      stored.
+ *
+ *      A mapping keeps its file alive after the cache closes it, so an
+ *      image is only needed while UMs may still map it. Images no UM
+ *      is using stay cached, most recently used first, up to
+ *      CACHE_LIMIT bytes; older ones are closed. Where
+ *      memory files are not available UMImage_open() returns NULL and
+ *      the UM loads the program privately.
+ *
+ *******************************************************/
+
+#define _GNU_SOURCE
+
+#include "Um_image.h"
+#include "Um_load.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS AND STRUCT DEFINITIONS
+ *
+ *******************************************************/
+
+#define CACHE_LIMIT (256 * 1024 * 1024)
+#define COMPARE_WORDS 1024
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+struct UM_image {
+        uint64_t hash;
+        size_t num_words;
+        int segment_fd;         /* header and words */
+        size_t segment_length;
+        int decoded_fd;         /* -1 until a UM shares its decoding */
+        size_t decoded_length;
+        unsigned users;         /* opened and not yet released */
+        struct UM_image *next;
+};
+
+/* A file's raw, big-endian words, mapped or read into memory */
+typedef struct Raw_program {
+        const Word *words;
+        size_t num_words;
+        size_t mapped_length;   /* 0 if the words were read */
+} Raw_program;
+
+/* Most recently opened first */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static UM_image cache = NULL;
+static size_t cache_length = 0;
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* out_of_memory() function
+ * Parameters:  none
+ *
+ * Returns:     void
+ *
+ * Purpose:     Reports a failed allocation and exits.
+ */
+static void out_of_memory(void)
+{
+        fprintf(stderr, "Out of memory loading program\n");
+        exit(EXIT_FAILURE);
+}
+
+/* read_raw() function
+ * Parameters:  program: const char * type; raw: Raw_program * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Maps the whole words of the given file, or reads them if
+ *              the file cannot be mapped. Exits with an error message if
+ *              the file cannot be opened or read.
+ */
+static void read_raw(const char *program, Raw_program *raw)
+{
+        struct stat buffer;
+        size_t length, done = 0;
+        Word *words;
+        ssize_t n;
+        int fd;
+
+        fd = open(program, O_RDONLY);
+        if (fd < 0 || fstat(fd, &buffer) != 0) {
+                fprintf(stderr, "Could not open file %s for reading\n",
+                        program);
+                exit(EXIT_FAILURE);
+        }
+        raw->num_words = (size_t) buffer.st_size / sizeof(Word);
+        raw->words = NULL;
+        raw->mapped_length = 0;
+        length = raw->num_words * sizeof(Word);
+        if (length == 0) {
+                close(fd);
+                return;
+        }
+        words = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (words != MAP_FAILED) {
+                raw->words = words;
+                raw->mapped_length = length;
+                close(fd);
+                return;
+        }
+        words = malloc(length);
+        if (words == NULL)
+                out_of_memory();
+        while (done < length) {
+                n = read(fd, (char *) words + done, length - done);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0) {
+                        fprintf(stderr, "Could not read %s\n", program);
+                        exit(EXIT_FAILURE);
+                }
+                done += (size_t) n;
+        }
+        raw->words = words;
+        close(fd);
+}
+
+/* free_raw() function
+ * Parameters:  raw: Raw_program * type
+ *
+ * Returns:     void
+ */
+static void free_raw(Raw_program *raw)
+{
+        if (raw->mapped_length != 0)
+                munmap((void *) raw->words, raw->mapped_length);
+        else
+                free((void *) raw->words);
+}
+
+/* hash_words() function
+ * Parameters:  words: const Word * type; num_words: size_t type
+ *
+ * Returns:     64-bit FNV-1a hash of the words, one word at a time:
+ *              uint64_t type
+ */
+static uint64_t hash_words(const Word *words, size_t num_words)
+{
+        uint64_t hash = FNV_OFFSET ^ num_words;
+        size_t i;
+
+        for (i = 0; i < num_words; i++)
+                hash = (hash ^ words[i]) * FNV_PRIME;
+        return hash;
+}
+
+/* new_file() function
+ * Parameters:  length: size_t type; data: void ** type
+ *
+ * Returns:     A memory file of the given length, or -1: int type
+ *
+ * Purpose:     Creates an anonymous memory file and maps it shared and
+ *              writable at *data so that it can be filled in.
+ */
+static int new_file(size_t length, void **data)
+{
+#if defined(__linux__)
+        int fd = memfd_create("um-image", MFD_CLOEXEC);
+
+        if (fd < 0)
+                return -1;
+        if (ftruncate(fd, (off_t) length) != 0) {
+                close(fd);
+                return -1;
+        }
+        *data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     0);
+        if (*data == MAP_FAILED) {
+                close(fd);
+                return -1;
+        }
+        return fd;
+#else
+        (void) length;
+        (void) data;
+        return -1;
+#endif
+}
+
+/* same_words() function
+ * Parameters:  image: UM_image type; raw: const Raw_program * type
+ *
+ * Returns:     true if the image holds exactly the raw words: int type
+ *
+ * Purpose:     Compares a cached image with a file's raw words, swapping
+ *              the raw words a block at a time.
+ */
+static int same_words(UM_image image, const Raw_program *raw)
+{
+        Word swapped[COMPARE_WORDS];
+        const Word *words;
+        size_t i, n;
+        void *data;
+        int same = 1;
+
+        if (image->num_words != raw->num_words)
+                return 0;
+        data = mmap(NULL, image->segment_length, PROT_READ, MAP_SHARED,
+                    image->segment_fd, 0);
+        if (data == MAP_FAILED)
+                return 0;
+        words = (const Word *) ((Segment_header *) data + 1);
+        for (i = 0; same && i < raw->num_words; i += n) {
+                n = raw->num_words - i;
+                if (n > COMPARE_WORDS)
+                        n = COMPARE_WORDS;
+                UMLoad_swap(swapped, raw->words + i, n);
+                same = memcmp(swapped, words + i, n * sizeof(Word)) == 0;
+        }
+        munmap(data, image->segment_length);
+        return same;
+}
+
+/* image_length() function
+ * Parameters:  image: UM_image type
+ *
+ * Returns:     Bytes of memory held by the image: size_t type
+ */
+static size_t image_length(UM_image image)
+{
+        return image->segment_length + image->decoded_length;
+}
+
+/* free_image() function
+ * Parameters:  image: UM_image type
+ *
+ * Returns:     void
+ */
+static void free_image(UM_image image)
+{
+        close(image->segment_fd);
+        if (image->decoded_fd >= 0)
+                close(image->decoded_fd);
+        free(image);
+}
+
+/* find_image() function
+ * Parameters:  hash: uint64_t type; raw: const Raw_program * type
+ *
+ * Returns:     The cached image of the raw words, or NULL: UM_image
+ *
+ * Purpose:     Looks up the cache and moves the image found to the
+ *              front. The cache lock must be held.
+ */
+static UM_image find_image(uint64_t hash, const Raw_program *raw)
+{
+        UM_image *link, image;
+
+        for (link = &cache; *link != NULL; link = &(*link)->next) {
+                image = *link;
+                if (image->hash == hash && same_words(image, raw)) {
+                        *link = image->next;
+                        image->next = cache;
+                        cache = image;
+                        return image;
+                }
+        }
+        return NULL;
+}
+
+/* trim_cache() function
+ * Parameters:  none
+ *
+ * Returns:     void
+ *
+ * Purpose:     Closes the least recently used images that no UM is
+ *              using until the cache fits in CACHE_LIMIT. The cache lock
+ *              must be held.
+ */
+static void trim_cache(void)
+{
+        UM_image *link, *oldest, image;
+
+        while (cache_length > CACHE_LIMIT) {
+                oldest = NULL;
+                for (link = &cache; *link != NULL; link = &(*link)->next)
+                        if ((*link)->users == 0)
+                                oldest = link;
+                if (oldest == NULL)
+                        return;
+                image = *oldest;
+                *oldest = image->next;
+                cache_length -= image_length(image);
+                free_image(image);
+        }
+}
+
+/* new_image() function
+ * Parameters:  hash: uint64_t type; raw: const Raw_program * type
+ *
+ * Returns:     A new image of the raw words, or NULL if no memory file
+ *              could be created: UM_image type
+ *
+ * Purpose:     Byte-swaps the raw words into a new memory file, behind a
+ *              segment header.
+ */
+static UM_image new_image(uint64_t hash, const Raw_program *raw)
+{
+        size_t length = sizeof(Segment_header) +
+                        raw->num_words * sizeof(Word);
+        Segment_header *header;
+        UM_image image;
+        void *data;
+        int fd;
+
+        fd = new_file(length, &data);
+        if (fd < 0)
+                return NULL;
+        header = data;
+        header->length = (Word) raw->num_words;
+        header->refs = 1;
+        UMLoad_swap((Word *) (header + 1), raw->words, raw->num_words);
+        munmap(data, length);
+
+        image = malloc(sizeof(struct UM_image));
+        if (image == NULL)
+                out_of_memory();
+        image->hash = hash;
+        image->num_words = raw->num_words;
+        image->segment_fd = fd;
+        image->segment_length = length;
+        image->decoded_fd = -1;
+        image->decoded_length = 0;
+        image->users = 1;
+        image->next = NULL;
+        return image;
+}
+
+/* map_private() function
+ * Parameters:  fd: int type; length: size_t type
+ *
+ * Returns:     A private, writable mapping of the file: void * type
+ */
+static void *map_private(int fd, size_t length)
+{
+        void *data = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+                out_of_memory();
+        return data;
+}
+
+/*******************************************************
+ *
+ *      PUBLIC FUNCTIONS
+ *
+ *******************************************************/
+
+/* UMImage_open() function
+ * Parameters:  program: const char * type
+ *
+ * Returns:     The cached image of the program in the given file, or
+ *              NULL if images cannot be shared on this host: UM_image
+ *
+ * Purpose:     Returns the cached image of the file's contents, loading
+ *              it if no cached image matches. The cache lock is not held
+ *              while a new image is built; if another thread adds the
+ *              same program meanwhile, its image is used and the new one
+ *              dropped. Exits with an error message if the file cannot
+ *              be opened or read. The caller must release the image with
+ *              UMImage_release(); mappings of it stay valid after that.
+ */
+UM_image UMImage_open(const char *program)
+{
+        Raw_program raw;
+        UM_image image, found;
+        uint64_t hash;
+
+        read_raw(program, &raw);
+        hash = hash_words(raw.words, raw.num_words);
+        pthread_mutex_lock(&cache_lock);
+        found = find_image(hash, &raw);
+        if (found != NULL)
+                found->users++;
+        pthread_mutex_unlock(&cache_lock);
+        if (found != NULL) {
+                free_raw(&raw);
+                return found;
+        }
+
+        image = new_image(hash, &raw);
+        if (image == NULL) {
+                free_raw(&raw);
+                return NULL;
+        }
+        pthread_mutex_lock(&cache_lock);
+        found = find_image(hash, &raw);
+        if (found != NULL) {
+                found->users++;
+        } else {
+                image->next = cache;
+                cache = image;
+                cache_length += image_length(image);
+                trim_cache();
+        }
+        pthread_mutex_unlock(&cache_lock);
+        free_raw(&raw);
+        if (found != NULL) {
+                free_image(image);
+                return found;
+        }
+        return image;
+}
+
+/* UMImage_release() function
+ * Parameters:  image: UM_image type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Ends a use of the image begun by UMImage_open(). The image
+ *              stays cached for later UMs while the cache has room.
+ */
+void UMImage_release(UM_image image)
+{
+        if (image == NULL)
+                return;
+        pthread_mutex_lock(&cache_lock);
+        image->users--;
+        trim_cache();
+        pthread_mutex_unlock(&cache_lock);
+}
+
+/* UMImage_map_segment() function
+ * Parameters:  image: UM_image type; length: size_t * type
+ *
+ * Returns:     A private, writable mapping of the image's segment: a
+ *              Segment_header followed by the words: void * type
+ *
+ * Purpose:     Maps the program for one UM; see UMSegment_adopt(). The
+ *              length of the mapping is stored in *length.
+ */
+void *UMImage_map_segment(UM_image image, size_t *length)
+{
+        *length = image->segment_length;
+        return map_private(image->segment_fd, image->segment_length);
+}
+
+/* UMImage_map_decoded() function
+ * Parameters:  image: UM_image type; length: size_t * type
+ *
+ * Returns:     A private, writable mapping of the image's decoded form,
+ *              or NULL if no UM has shared one yet: void * type
+ */
+void *UMImage_map_decoded(UM_image image, size_t *length)
+{
+        void *decoded = NULL;
+
+        pthread_mutex_lock(&cache_lock);
+        *length = image->decoded_length;
+        if (image->decoded_fd >= 0)
+                decoded = map_private(image->decoded_fd, *length);
+        pthread_mutex_unlock(&cache_lock);
+        return decoded;
+}
+
+/* UMImage_share_decoded() function
+ * Parameters:  image: UM_image type; decoded: const void * type;
+ *              length: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Offers the decoded form of the image made by a UM to the
+ *              UMs that open the image later. It is copied unless the
+ *              image already has one. The decoded form must depend only
+ *              on the words.
+ */
+void UMImage_share_decoded(UM_image image, const void *decoded,
+                           size_t length)
+{
+        void *data;
+        int fd;
+
+        pthread_mutex_lock(&cache_lock);
+        if (image->decoded_fd < 0) {
+                fd = new_file(length, &data);
+                if (fd >= 0) {
+                        memcpy(data, decoded, length);
+                        munmap(data, length);
+                        image->decoded_fd = fd;
+                        image->decoded_length = length;
+                        cache_length += length;
+                }
+        }
+        pthread_mutex_unlock(&cache_lock);
+}
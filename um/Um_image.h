@@ -0,0 +1,32 @@
+/*******************************************************
+ *
+ *      Um_image.h
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_image.h contains the interface of the UM program image cache.
+ *      Programs are loaded once per process and identified by a hash of
+ *      their contents, so UMs running the same program, from any path,
+ *      share one copy of its words and of its decoded form. Each UM
+ *      maps the shared copy privately: pages are shared until the UM
+ *      writes to them, and only the pages written are copied. The cache
+ *      is safe to use from several threads.
+ *
+ *******************************************************/
+
+#ifndef UM_IMAGE
+#define UM_IMAGE
+
+#include <stddef.h>
+#include "Um_instructions.h"
+
+typedef struct UM_image *UM_image;
+
+UM_image UMImage_open(const char *program);
+void UMImage_release(UM_image image);
+void *UMImage_map_segment(UM_image image, size_t *length);
+void *UMImage_map_decoded(UM_image image, size_t *length);
+void UMImage_share_decoded(UM_image image, const void *decoded,
+                           size_t length);
+
+#endif
@@ -0,0 +1,494 @@
+/*******************************************************
+ *
+ *      Um_input.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_input.c contains the implementation of the UM input module.
+ *
+ *      Regular files are mapped from the current offset to the end in
+ *      one piece, so the whole input is a single [next, end) range.
+ *      Pipes are read by a prefetch thread into a ring buffer. The
+ *      thread owns the free part of the ring and the reader owns the
+ *      part it was handed by the last refill; the two only meet, under
+ *      a mutex, when the reader gives back what it consumed and takes
+ *      the next filled piece. Terminals are read directly, since the
+ *      output has to be flushed before each blocking read anyway.
+ *      Hosted input is a growable buffer that the host appends to; the
+ *      unread bytes are moved to the front before it has to grow.
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include "Um_input.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS AND STRUCT DEFINITIONS
+ *
+ *******************************************************/
+
+#define RING_SIZE (4 * 1024 * 1024)
+#define MAX_PIECE (RING_SIZE / 8)
+#define DIRECT_SIZE (64 * 1024)
+
+typedef enum Input_kind {
+        UNOPENED, MAPPED, DIRECT, PREFETCH, HOSTED
+} Input_kind;
+
+typedef struct Input {
+        struct UM_input range;
+        Input_kind kind;
+        int fd;
+
+        /* MAPPED: the mapping of the file */
+        unsigned char *map;
+        size_t map_length;
+
+        /* DIRECT: read buffer; PREFETCH: ring buffer; HOSTED: pushed
+         * bytes, of which [next, end) are unread */
+        unsigned char *buf;
+        size_t buf_size;
+
+        /* PREFETCH: head and tail count bytes ever written and freed */
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t changed;
+        uint64_t head, tail;
+        bool closing;
+
+        /* PREFETCH and HOSTED: no more input will arrive */
+        bool eof;
+} *Input;
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* out_of_memory() function
+ * Parameters:  none
+ *
+ * Returns:     void
+ *
+ * Purpose:     Reports a failed allocation and exits.
+ */
+static void out_of_memory(void)
+{
+        fprintf(stderr, "Out of memory reading input\n");
+        exit(EXIT_FAILURE);
+}
+
+/* prefetch() function
+ * Parameters:  arg: the Input to fill: void * type
+ *
+ * Returns:     NULL
+ *
+ * Purpose:     Body of the prefetch thread. Reads the input into the
+ *              free part of the ring until end of input or until the
+ *              Input is freed. Only the blocking read() can be cancelled;
+ *              a wait for free space ends when 'closing' is set.
+ */
+static void *prefetch(void *arg)
+{
+        Input in = arg;
+        size_t start, space;
+        ssize_t n;
+
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        pthread_mutex_lock(&in->lock);
+        for (;;) {
+                while (in->head - in->tail == RING_SIZE && !in->closing)
+                        pthread_cond_wait(&in->changed, &in->lock);
+                if (in->closing)
+                        break;
+                start = in->head % RING_SIZE;
+                space = RING_SIZE - (in->head - in->tail);
+                if (space > RING_SIZE - start)
+                        space = RING_SIZE - start;
+                pthread_mutex_unlock(&in->lock);
+
+                pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+                n = read(in->fd, in->buf + start, space);
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+                pthread_mutex_lock(&in->lock);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0) {
+                        in->eof = true;
+                        pthread_cond_broadcast(&in->changed);
+                        break;
+                }
+                in->head += (uint64_t) n;
+                pthread_cond_broadcast(&in->changed);
+        }
+        pthread_mutex_unlock(&in->lock);
+        return NULL;
+}
+
+/* open_mapped() function
+ * Parameters:  in: Input type; size: size of the file: off_t type
+ *
+ * Returns:     true if the rest of the file was mapped: bool type
+ *
+ * Purpose:     Maps the input file from its current offset to its end.
+ *              The mapping starts on the page boundary at or below the
+ *              offset.
+ */
+static bool open_mapped(Input in, off_t size)
+{
+        off_t offset = lseek(in->fd, 0, SEEK_CUR);
+        off_t page = sysconf(_SC_PAGESIZE);
+        off_t base;
+
+        if (offset < 0)
+                return false;
+        in->range.next = in->range.end = NULL;
+        if (offset >= size)
+                return true;
+        base = offset - offset % page;
+        in->map_length = (size_t) (size - base);
+        in->map = mmap(NULL, in->map_length, PROT_READ, MAP_PRIVATE,
+                       in->fd, base);
+        if (in->map == MAP_FAILED) {
+                in->map = NULL;
+                return false;
+        }
+        madvise(in->map, in->map_length, MADV_SEQUENTIAL);
+        in->range.next = in->map + (offset - base);
+        in->range.end = in->map + in->map_length;
+        lseek(in->fd, size, SEEK_SET);
+        return true;
+}
+
+/* open_prefetch() function
+ * Parameters:  in: Input type
+ *
+ * Returns:     true if the prefetch thread was started: bool type
+ *
+ * Purpose:     Sets up the ring buffer and starts the prefetch thread.
+ */
+static bool open_prefetch(Input in)
+{
+        in->buf = malloc(RING_SIZE);
+        if (in->buf == NULL)
+                out_of_memory();
+        in->head = in->tail = 0;
+        in->eof = in->closing = false;
+        in->range.next = in->range.end = in->buf;
+        pthread_mutex_init(&in->lock, NULL);
+        pthread_cond_init(&in->changed, NULL);
+        if (pthread_create(&in->thread, NULL, prefetch, in) != 0) {
+                pthread_mutex_destroy(&in->lock);
+                pthread_cond_destroy(&in->changed);
+                free(in->buf);
+                in->buf = NULL;
+                return false;
+        }
+        return true;
+}
+
+/* open_input() function
+ * Parameters:  in: Input type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Chooses how the input is read, on the first use of an
+ *              unopened Input. DIRECT is the fallback when mapping or
+ *              starting the thread fails.
+ */
+static void open_input(Input in)
+{
+        struct stat buffer;
+
+        if (fstat(in->fd, &buffer) == 0 && S_ISREG(buffer.st_mode) &&
+            open_mapped(in, buffer.st_size)) {
+                in->kind = MAPPED;
+                return;
+        }
+        if (!isatty(in->fd) && open_prefetch(in)) {
+                in->kind = PREFETCH;
+                return;
+        }
+        in->buf = malloc(DIRECT_SIZE);
+        if (in->buf == NULL)
+                out_of_memory();
+        in->range.next = in->range.end = in->buf;
+        in->kind = DIRECT;
+}
+
+/* refill_direct() function
+ * Parameters:  in: Input type
+ *
+ * Returns:     The next input byte, or -1 at end of input: int type
+ *
+ * Purpose:     Reads whatever is available, up to DIRECT_SIZE bytes,
+ *              blocking until at least one byte arrives.
+ */
+static int refill_direct(Input in)
+{
+        ssize_t n;
+
+        do {
+                n = read(in->fd, in->buf, DIRECT_SIZE);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+                return -1;
+        in->range.next = in->buf + 1;
+        in->range.end = in->buf + n;
+        return in->buf[0];
+}
+
+/* refill_prefetch() function
+ * Parameters:  in: Input type
+ *
+ * Returns:     The next input byte, or -1 at end of input: int type
+ *
+ * Purpose:     Gives the consumed piece of the ring back to the prefetch
+ *              thread and takes the next filled piece, waiting for the
+ *              thread if the ring is empty. Pieces are at most MAX_PIECE
+ *              bytes so that the thread can keep reading while the UM
+ *              works through one.
+ */
+static int refill_prefetch(Input in)
+{
+        size_t start, length;
+
+        pthread_mutex_lock(&in->lock);
+        in->tail += (uint64_t) (in->range.next -
+                                (in->buf + in->tail % RING_SIZE));
+        pthread_cond_broadcast(&in->changed);
+        while (in->head == in->tail && !in->eof)
+                pthread_cond_wait(&in->changed, &in->lock);
+        if (in->head == in->tail) {
+                in->range.next = in->range.end =
+                        in->buf + in->tail % RING_SIZE;
+                pthread_mutex_unlock(&in->lock);
+                return -1;
+        }
+        start = in->tail % RING_SIZE;
+        length = in->head - in->tail;
+        if (length > RING_SIZE - start)
+                length = RING_SIZE - start;
+        if (length > MAX_PIECE)
+                length = MAX_PIECE;
+        pthread_mutex_unlock(&in->lock);
+
+        in->range.next = in->buf + start + 1;
+        in->range.end = in->buf + start + length;
+        return in->buf[start];
+}
+
+/*******************************************************
+ *
+ *      PUBLIC FUNCTIONS
+ *
+ *******************************************************/
+
+/* UMInput_new() function
+ * Parameters:  fd: int type
+ *
+ * Returns:     Initialized UM_input
+ *
+ * Purpose:     Creates an input that reads from the given file
+ *              descriptor. Nothing is read until the first byte is
+ *              asked for.
+ */
+UM_input UMInput_new(int fd)
+{
+        Input in = malloc(sizeof(struct Input));
+
+        if (in == NULL)
+                out_of_memory();
+        in->range.next = in->range.end = NULL;
+        in->kind = UNOPENED;
+        in->fd = fd;
+        in->map = NULL;
+        in->buf = NULL;
+        return &in->range;
+}
+
+/* UMInput_new_hosted() function
+ * Parameters:  none
+ *
+ * Returns:     Initialized UM_input
+ *
+ * Purpose:     Creates an input that holds only the bytes given to
+ *              UMInput_push(). It never blocks: when the pushed bytes
+ *              are used up, UMInput_ready() is false until more are
+ *              pushed or the input is closed.
+ */
+UM_input UMInput_new_hosted(void)
+{
+        Input in = (Input) UMInput_new(-1);
+
+        in->kind = HOSTED;
+        in->buf = malloc(DIRECT_SIZE);
+        if (in->buf == NULL)
+                out_of_memory();
+        in->buf_size = DIRECT_SIZE;
+        in->range.next = in->range.end = in->buf;
+        in->eof = false;
+        return &in->range;
+}
+
+/* UMInput_push() function
+ * Parameters:  input: UM_input type; bytes: const void * type;
+ *              length: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Appends 'length' bytes to a hosted input, after any bytes
+ *              that have not been read yet.
+ */
+void UMInput_push(UM_input input, const void *bytes, size_t length)
+{
+        Input in = (Input) input;
+        size_t unread = (size_t) (in->range.end - in->range.next);
+        size_t used = (size_t) (in->range.end - in->buf);
+        size_t size = in->buf_size;
+        unsigned char *buf = in->buf;
+
+        if (used + length > size) {
+                while (size < unread + length)
+                        size *= 2;
+                if (size != in->buf_size) {
+                        buf = malloc(size);
+                        if (buf == NULL)
+                                out_of_memory();
+                }
+                memmove(buf, in->range.next, unread);
+                if (buf != in->buf) {
+                        free(in->buf);
+                        in->buf = buf;
+                        in->buf_size = size;
+                }
+                in->range.next = buf;
+                in->range.end = buf + unread;
+        }
+        memcpy(in->buf + (in->range.end - in->buf), bytes, length);
+        in->range.end += length;
+}
+
+/* UMInput_close() function
+ * Parameters:  input: UM_input type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Marks the end of a hosted input. Once the bytes already
+ *              pushed are read, IN reads end of input.
+ */
+void UMInput_close(UM_input input)
+{
+        ((Input) input)->eof = true;
+}
+
+/* UMInput_free() function
+ * Parameters:  input: UM_input type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Stops the prefetch thread, if any, and frees the input.
+ *              Input that was read ahead but not consumed is lost.
+ */
+void UMInput_free(UM_input input)
+{
+        Input in = (Input) input;
+
+        if (in == NULL)
+                return;
+        if (in->kind == PREFETCH) {
+                pthread_mutex_lock(&in->lock);
+                in->closing = true;
+                pthread_cond_broadcast(&in->changed);
+                pthread_mutex_unlock(&in->lock);
+                pthread_cancel(in->thread);
+                pthread_join(in->thread, NULL);
+                pthread_mutex_destroy(&in->lock);
+                pthread_cond_destroy(&in->changed);
+        }
+        if (in->map != NULL)
+                munmap(in->map, in->map_length);
+        free(in->buf);
+        free(in);
+}
+
+/* UMInput_ready() function
+ * Parameters:  input: UM_input type
+ *
+ * Returns:     true if UMInput_get() would not block: bool type
+ *
+ * Purpose:     Tells whether a byte (or end of input) can be read right
+ *              away. Used to flush output only before IN would block.
+ */
+bool UMInput_ready(UM_input input)
+{
+        Input in = (Input) input;
+        struct pollfd pfd;
+        bool ready;
+
+        if (in->range.next < in->range.end)
+                return true;
+        if (in->kind == UNOPENED)
+                open_input(in);
+
+        switch (in->kind) {
+        case PREFETCH:
+                pthread_mutex_lock(&in->lock);
+                ready = in->eof || in->head - in->tail >
+                        (uint64_t) (in->range.end -
+                                    (in->buf + in->tail % RING_SIZE));
+                pthread_mutex_unlock(&in->lock);
+                return ready;
+        case DIRECT:
+                pfd.fd = in->fd;
+                pfd.events = POLLIN;
+                return poll(&pfd, 1, 0) > 0;
+        case HOSTED:
+                return in->eof;
+        default:
+                return true;
+        }
+}
+
+/* UMInput_refill() function
+ * Parameters:  input: UM_input type
+ *
+ * Returns:     The next input byte, or -1 at end of input: int type
+ *
+ * Purpose:     Called by UMInput_get() when [next, end) is empty. Finds
+ *              more input, blocking if needed, and consumes its first
+ *              byte.
+ */
+int UMInput_refill(UM_input input)
+{
+        Input in = (Input) input;
+
+        if (in->kind == UNOPENED) {
+                open_input(in);
+                if (in->range.next < in->range.end)
+                        return *in->range.next++;
+        }
+
+        switch (in->kind) {
+        case PREFETCH:
+                return refill_prefetch(in);
+        case DIRECT:
+                return refill_direct(in);
+        default:
+                return -1;
+        }
+}
@@ -0,0 +1,57 @@
+/*******************************************************
+ *
+ *      Um_input.h
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_input.h contains the interface of the UM input module, which
+ *      supplies the bytes read by IN. The bytes that can be read
+ *      without blocking are exposed as the range [next, end), so that
+ *      UMInput_get() is a bounds check and a load; UMInput_refill()
+ *      finds more input once the range is used up.
+ *
+ *      The input source is chosen on first use. A regular file is
+ *      mmap'd, a pipe (or any other non-terminal) is read ahead into a
+ *      ring buffer by a prefetch thread, and a terminal is read with
+ *      read(2) when the program asks for input. A hosted input has no
+ *      file descriptor: its bytes are pushed by the program embedding
+ *      the UM, and it never blocks.
+ *
+ *******************************************************/
+
+#ifndef UM_INPUT
+#define UM_INPUT
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct UM_input {
+        const unsigned char *next;
+        const unsigned char *end;
+};
+
+typedef struct UM_input *UM_input;
+
+UM_input UMInput_new(int fd);
+UM_input UMInput_new_hosted(void);
+void UMInput_push(UM_input input, const void *bytes, size_t length);
+void UMInput_close(UM_input input);
+void UMInput_free(UM_input input);
+bool UMInput_ready(UM_input input);
+int UMInput_refill(UM_input input);
+
+/* UMInput_get() function
+ * Parameters:  input: UM_input type
+ *
+ * Returns:     The next input byte, or -1 at end of input: int type
+ *
+ * Purpose:     Reads one byte of input, blocking if none is available.
+ */
+static inline int UMInput_get(UM_input input)
+{
+        if (input->next < input->end)
+                return *input->next++;
+        return UMInput_refill(input);
+}
+
+#endif
@@ -1,7 +1,11 @@
+#define _DEFAULT_SOURCE
+
 #include "Um_instructions.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <um-dis.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 /*******************************************************
  *
@@ -9,30 +13,490 @@
  *
  *******************************************************/
 
-#define SEQ_HINT 0
+#define INITIAL_SEGS 64
+
+/* Freed segments are kept in per-size-class free lists and handed out
+ * again by later MAPs of the same class. Class k holds segments of up
+ * to 2^k words. Segments larger than the biggest class are never pooled,
+ * and once POOL_HIGH_WATER bytes are pooled, freed segments go back to
+ * the system allocator instead.
+ */
+#define NUM_CLASSES 17
+#define POOL_HIGH_WATER (64 * 1024 * 1024)
+
+struct Segment_pool {
+        Word **blocks[NUM_CLASSES];
+        uint32_t count[NUM_CLASSES];
+        uint32_t capacity[NUM_CLASSES];
+        size_t pooled_bytes;
+};
+
+/* The arena backend keeps every segment in one reserved mapping: blocks
+ * of a Segment_header and an even number of words, back to back from
+ * base up to top, with every word past clean (at or above top) zero.
+ * Arena size classes
+ * are the pool's up to 2^(NUM_CLASSES - 1) words and then split each
+ * doubling in four, so a large block wastes at most a fifth; its size
+ * follows from the length in its header and the arena can be walked
+ * block by block. Freed blocks keep their header with refs at 0 and go
+ * on the free list of their class. Once at least COMPACT_MIN_WORDS
+ * words and half the arena are free, the next MAP first compacts the
+ * arena: live blocks slide down over the free ones and the segment
+ * table is updated. The arena can grow back to the new top plus the
+ * larger of that top and COMPACT_MIN_WORDS before it is compacted
+ * again, so only pages well past that are returned to the system; the
+ * words below are cleared as blocks are taken from the top, as the
+ * heap backend clears pooled blocks, rather than faulted in again.
+ * Segments that do not fit in the arena are allocated as in the heap
+ * backend.
+ */
+#define ARENA_RESERVE ((size_t) 1 << 36)
+#define COMPACT_MIN_WORDS ((size_t) 4 * 1024 * 1024)
+#define HEADER_WORDS (sizeof(Segment_header) / sizeof(Word))
+#define ARENA_CLASSES (NUM_CLASSES + 4 * (33 - NUM_CLASSES))
 
-struct Segments {
-        Seq_T available_IDs;
-        Seq_T seg_array; 
+struct Segment_arena {
+        Word *base;
+        size_t top;
+        size_t clean;
+        size_t reserved;
+        size_t free_words;
+        Word **free_blocks[ARENA_CLASSES];
+        uint32_t count[ARENA_CLASSES];
+        uint32_t capacity[ARENA_CLASSES];
 };
 
+/* The backend new segment tables use */
+static UMSegment_backend default_backend = UMSEGMENT_HEAP;
+
+static const char *const backend_names[] = { "heap", "arena", "huge" };
+
 /*******************************************************
  *
  *      PRIVATE HELPER FUNCTIONS
  *
  *******************************************************/
 
+/* out_of_memory() function
+ * Parameters:  none
+ *
+ * Returns:     does not return
+ *
+ * Purpose:     Reports that UM memory could not be allocated and exits.
+ */
+static void out_of_memory(void)
+{
+        fprintf(stderr, "Out of memory allocating UM segment\n");
+        exit(EXIT_FAILURE);
+}
+
+/* size_class() function
+ * Parameters:  size: Word type
+ *
+ * Returns:     Smallest class k with 2^k >= size
+ */
+static inline unsigned size_class(Word size)
+{
+        return size <= 1 ? 0 : 32 - __builtin_clz(size - 1);
+}
+
+/* class_bytes() function
+ * Parameters:  class: unsigned type
+ *
+ * Returns:     Size in bytes of a block of the given size class
+ */
+static inline size_t class_bytes(unsigned class)
+{
+        return sizeof(Segment_header) + ((size_t) 1 << class) * sizeof(Word);
+}
+
+/* arena_class() function
+ * Parameters:  length: Word type
+ *
+ * Returns:     The arena size class of a segment of the given length:
+ *              its size class below NUM_CLASSES, and above that four
+ *              classes per size class, holding 5/8, 6/8, 7/8 and all of
+ *              2^k words
+ */
+static inline unsigned arena_class(Word length)
+{
+        unsigned class = size_class(length);
+
+        if (class < NUM_CLASSES)
+                return class;
+        return NUM_CLASSES + 4 * (class - NUM_CLASSES) +
+               (unsigned) (((size_t) length - 1) >> (class - 3)) - 4;
+}
+
+/* block_words() function
+ * Parameters:  length: Word type
+ *
+ * Returns:     Size in words, header included, of the arena block of a
+ *              segment of the given length: size_t type
+ */
+static inline size_t block_words(Word length)
+{
+        unsigned class = arena_class(length), k;
+        size_t words = (size_t) 1 << class;
+
+        if (class >= NUM_CLASSES) {
+                k = NUM_CLASSES + (class - NUM_CLASSES) / 4;
+                words = (size_t) ((class - NUM_CLASSES) % 4 + 5) << (k - 3);
+        }
+        return HEADER_WORDS + ((words + 1) & ~(size_t) 1);
+}
+
+/* in_arena() function
+ * Parameters:  arena: struct Segment_arena * type; words: Word * type
+ *
+ * Returns:     true if the segment lives in the given arena, which may
+ *              be NULL: int type
+ */
+static inline int in_arena(struct Segment_arena *arena, Word *words)
+{
+        return arena != NULL && words >= arena->base &&
+               (size_t) (words - arena->base) < arena->reserved;
+}
+
+/* new_arena() function
+ * Parameters:  huge: int type
+ *
+ * Returns:     A new empty arena, or NULL if the address space for it
+ *              cannot be reserved: struct Segment_arena * type
+ *
+ * Purpose:     Reserves ARENA_RESERVE bytes for an arena; pages are only
+ *              backed by memory once written. If huge is true, asks for
+ *              the arena to be backed by transparent huge pages.
+ */
+static struct Segment_arena *new_arena(int huge)
+{
+        struct Segment_arena *arena = calloc(1, sizeof(*arena));
+        void *base;
+
+        if (arena == NULL)
+                out_of_memory();
+        base = mmap(NULL, ARENA_RESERVE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+                free(arena);
+                return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge)
+                madvise(base, ARENA_RESERVE, MADV_HUGEPAGE);
+#else
+        (void) huge;
+#endif
+        arena->base = base;
+        arena->reserved = ARENA_RESERVE / sizeof(Word);
+        return arena;
+}
+
+/* arena_segment() function
+ * Parameters:  arena: struct Segment_arena * type; size: int type
+ *
+ * Returns:     Pointer to the first word of a new zeroed segment of
+ *              length size, or NULL if the arena is full
+ *
+ * Purpose:     Takes a free block of the segment's size class if there
+ *              is one, clearing the words the segment uses; otherwise
+ *              adds a block at the top of the arena, clearing the words
+ *              of it below clean.
+ */
+static Word *arena_segment(struct Segment_arena *arena, int size)
+{
+        unsigned class = arena_class(size);
+        size_t words = block_words(size), dirty;
+        Segment_header *header;
+        Word *segment;
+
+        if (arena->count[class] > 0) {
+                segment = arena->free_blocks[class][--arena->count[class]];
+                arena->free_words -= words;
+                memset(segment, 0, (size_t) size * sizeof(Word));
+                SEGMENT_HEADER(segment)->length = size;
+                SEGMENT_HEADER(segment)->refs = 1;
+                return segment;
+        }
+        if (words > arena->reserved - arena->top)
+                return NULL;
+        header = (Segment_header *) (arena->base + arena->top);
+        dirty = arena->clean > arena->top + HEADER_WORDS ?
+                arena->clean - arena->top - HEADER_WORDS : 0;
+        if (dirty > (size_t) size)
+                dirty = size;
+        memset(header + 1, 0, dirty * sizeof(Word));
+        arena->top += words;
+        if (arena->clean < arena->top)
+                arena->clean = arena->top;
+        header->length = size;
+        header->refs = 1;
+        return (Word *) (header + 1);
+}
+
+/* arena_free() function
+ * Parameters:  arena: struct Segment_arena * type; words: Word * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Returns the block of the freed segment whose words start
+ *              at the given pointer to the free list of its arena size
+ *              class.
+ */
+static void arena_free(struct Segment_arena *arena, Word *words)
+{
+        Word length = SEGMENT_HEADER(words)->length;
+        unsigned class = arena_class(length);
+
+        arena->free_words += block_words(length);
+        if (arena->count[class] == arena->capacity[class]) {
+                arena->capacity[class] = arena->capacity[class] ?
+                                         arena->capacity[class] * 2 : 16;
+                arena->free_blocks[class] =
+                        realloc(arena->free_blocks[class],
+                                arena->capacity[class] * sizeof(Word *));
+                if (arena->free_blocks[class] == NULL)
+                        out_of_memory();
+        }
+        arena->free_blocks[class][arena->count[class]++] = words;
+}
+
+/* release_tail() function
+ * Parameters:  arena: struct Segment_arena * type; top: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Lowers the top of the arena to the given word. Whole
+ *              pages past twice the new top plus COMPACT_MIN_WORDS, well
+ *              past where the arena would be compacted again, are given
+ *              back to the system, which maps them to zero pages again on
+ *              use, and clean is lowered to them.
+ */
+static void release_tail(struct Segment_arena *arena, size_t top)
+{
+        size_t keep = 2 * top + COMPACT_MIN_WORDS;
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = ((uintptr_t) (arena->base + keep) + page - 1) &
+                          ~(page - 1);
+        uintptr_t end = (uintptr_t) (arena->base + arena->clean);
+
+        if (start < end) {
+                madvise((void *) start, end - start, MADV_DONTNEED);
+                arena->clean = (Word *) start - arena->base;
+        }
+        arena->top = top;
+}
+
 /* new_segment() function
- * Parameters:  size: int type
+ * Parameters:  segments: Segments type; size: int type
  *
- * Returns:     UArray_T representing new segment
+ * Returns:     Pointer to the first word of the new segment
+ *
+ * Purpose:     Creates a new zeroed segment of length size and returns
+ *              a pointer to its words, in the arena if the table has one
+ *              and there is room. Otherwise reuses a pooled block of the
+ *              same size class when there is one, clearing only the words
+ *              the new segment uses. The segment header is stored just
+ *              before the first word.
+ */
+static inline Word *new_segment(Segments segments, int size)
+{
+        struct Segment_pool *pool = segments->pool;
+        unsigned class = size_class(size);
+        Segment_header *header;
+        Word *words;
+
+        if (segments->arena != NULL) {
+                words = arena_segment(segments->arena, size);
+                if (words != NULL)
+                        return words;
+        }
+        if (class < NUM_CLASSES && pool->count[class] > 0) {
+                words = pool->blocks[class][--pool->count[class]];
+                pool->pooled_bytes -= class_bytes(class);
+                memset(words, 0, (size_t) size * sizeof(Word));
+                SEGMENT_HEADER(words)->length = size;
+                SEGMENT_HEADER(words)->refs = 1;
+                return words;
+        }
+        if (class < NUM_CLASSES)
+                header = calloc(1, class_bytes(class));
+        else
+                header = calloc(1, sizeof(Segment_header) +
+                                (size_t) size * sizeof(Word));
+        if (header == NULL)
+                out_of_memory();
+        header->length = size;
+        header->refs = 1;
+        return (Word *) (header + 1);
+}
+
+/* in_image() function
+ * Parameters:  segments: Segments type; words: Word * type
  *
- * Purpose:     Creates a new segment of length size and returns it. 
+ * Returns:     true if the segment lives in a mapped snapshot: int type
  */
-static inline UArray_T new_segment(int size)
+static inline int in_image(Segments segments, Word *words)
 {
-        UArray_T segment = UArray_new(size, sizeof(Word));
-        return segment;
+        uintptr_t p = (uintptr_t) words, image = (uintptr_t) segments->image;
+
+        return p >= image && p - image < segments->image_length;
+}
+
+/* free_segment() function
+ * Parameters:  segments: Segments type; words: Word * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Releases the segment whose words start at the given
+ *              pointer into the pool of its size class, or frees it when
+ *              it is too large to pool or the pool is past its high-water
+ *              mark. Segments in a snapshot image are left where they are,
+ *              and arena segments go back to the arena.
+ */
+static inline void free_segment(Segments segments, Word *words)
+{
+        struct Segment_pool *pool = segments->pool;
+        unsigned class = size_class(SEGMENT_HEADER(words)->length);
+
+        if (in_image(segments, words))
+                return;
+        if (in_arena(segments->arena, words)) {
+                arena_free(segments->arena, words);
+                return;
+        }
+        if (class >= NUM_CLASSES ||
+            pool->pooled_bytes + class_bytes(class) > POOL_HIGH_WATER) {
+                free(SEGMENT_HEADER(words));
+                return;
+        }
+        if (pool->count[class] == pool->capacity[class]) {
+                pool->capacity[class] = pool->capacity[class] ?
+                                        pool->capacity[class] * 2 : 16;
+                pool->blocks[class] = realloc(pool->blocks[class],
+                                              pool->capacity[class] *
+                                              sizeof(Word *));
+                if (pool->blocks[class] == NULL)
+                        out_of_memory();
+        }
+        pool->blocks[class][pool->count[class]++] = words;
+        pool->pooled_bytes += class_bytes(class);
+}
+
+/* release_segment() function
+ * Parameters:  segments: Segments type; words: Word * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Drops one reference to the segment whose words start at
+ *              the given pointer and frees it once no ID refers to it.
+ */
+static inline void release_segment(Segments segments, Word *words)
+{
+        if (--SEGMENT_HEADER(words)->refs == 0)
+                free_segment(segments, words);
+}
+
+/* grow() function
+ * Parameters:  array: pointer to the array; capacity: pointer to its
+ *              capacity in elements; elem_size: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Doubles the capacity of a growable array in place.
+ */
+static void grow(void **array, uint32_t *capacity, size_t elem_size)
+{
+        uint32_t new_capacity = *capacity * 2;
+        void *new_array = realloc(*array, new_capacity * elem_size);
+        if (new_array == NULL)
+                out_of_memory();
+        *array = new_array;
+        *capacity = new_capacity;
+}
+
+/* next_ID() function
+ * Parameters:  segments: Segments type
+ *
+ * Returns:     The ID for the next segment to be mapped: Segment_ID type
+ *
+ * Purpose:     Takes the most recently freed ID if there is one, and
+ *              otherwise adds a new ID at the end of the segment array.
+ */
+static inline Segment_ID next_ID(Segments segments)
+{
+        Segment_ID ID;
+
+        if (segments->num_available > 0) {
+                ID = segments->available_IDs[--segments->num_available];
+        } else {
+                if (segments->num_segs == segments->seg_capacity)
+                        grow((void **) &segments->seg_array,
+                             &segments->seg_capacity, sizeof(Word *));
+                ID = segments->num_segs++;
+        }
+        return ID;
+}
+
+/* compact() function
+ * Parameters:  segments: Segments type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Slides the live blocks of the table's arena down over the
+ *              free ones, in address order, and points every ID at the
+ *              new place of its segment; IDs sharing a segment move
+ *              together. The free lists are emptied and the pages past
+ *              the new top are released. Must not be called while anyone
+ *              holds a pointer to the words of an arena segment.
+ */
+static void compact(Segments segments)
+{
+        struct Segment_arena *arena = segments->arena;
+        size_t *from = malloc((segments->num_segs + 1) * sizeof(size_t));
+        size_t *to = malloc((segments->num_segs + 1) * sizeof(size_t));
+        size_t offset, size, top = 0;
+        uint32_t live = 0, i, lo, hi, mid;
+        Segment_header *header;
+        Word *words;
+
+        if (from == NULL || to == NULL)
+                out_of_memory();
+        for (offset = 0; offset < arena->top; offset += size) {
+                header = (Segment_header *) (arena->base + offset);
+                size = block_words(header->length);
+                if (header->refs == 0)
+                        continue;
+                from[live] = offset;
+                to[live++] = top;
+                top += size;
+        }
+        for (i = 0; i < segments->num_segs; i++) {
+                words = segments->seg_array[i];
+                if (!in_arena(arena, words))
+                        continue;
+                offset = words - arena->base - HEADER_WORDS;
+                for (lo = 0, hi = live; hi - lo > 1;) {
+                        mid = lo + (hi - lo) / 2;
+                        if (from[mid] <= offset)
+                                lo = mid;
+                        else
+                                hi = mid;
+                }
+                segments->seg_array[i] = arena->base + to[lo] + HEADER_WORDS;
+        }
+        for (i = 0; i < live; i++) {
+                if (to[i] == from[i])
+                        continue;
+                header = (Segment_header *) (arena->base + from[i]);
+                memmove(arena->base + to[i], header,
+                        block_words(header->length) * sizeof(Word));
+        }
+        release_tail(arena, top);
+        arena->free_words = 0;
+        memset(arena->count, 0, sizeof(arena->count));
+        free(from);
+        free(to);
 }
 
 /*******************************************************
@@ -47,15 +511,33 @@ static inline UArray_T new_segment(int size)
  * Returns:     Pointer to Segments struct representing new UM memory
  *
  * Purpose:     Allocates space for a new Segments struct pointer and 
- *              initializes the two sequences of the struct. Returns the 
- *              initializes Segments.
+ *              initializes its segment table and its stack of available
+ *              IDs, with an arena if the backend set with
+ *              UMSegment_set_backend() is one and address space for it
+ *              can be reserved. Returns the initialized Segments.
  */     
 Segments UMSegment_new()
 {
         Segments segments = malloc(sizeof(struct Segments));
-        *segments = (struct Segments) {
-                Seq_new(SEQ_HINT), Seq_new(SEQ_HINT)
-        };
+        if (segments == NULL)
+                out_of_memory();
+        segments->seg_array = malloc(INITIAL_SEGS * sizeof(Word *));
+        segments->available_IDs = malloc(INITIAL_SEGS * sizeof(Segment_ID));
+        if (segments->seg_array == NULL || segments->available_IDs == NULL)
+                out_of_memory();
+        segments->num_segs = 0;
+        segments->seg_capacity = INITIAL_SEGS;
+        segments->num_available = 0;
+        segments->available_capacity = INITIAL_SEGS;
+        segments->pool = calloc(1, sizeof(struct Segment_pool));
+        if (segments->pool == NULL)
+                out_of_memory();
+        segments->image = NULL;
+        segments->image_length = 0;
+        segments->arena = NULL;
+        if (default_backend != UMSEGMENT_HEAP)
+                segments->arena = new_arena(default_backend ==
+                                            UMSEGMENT_ARENA_HUGE);
         return segments;
 }
 
@@ -70,34 +552,76 @@ Segments UMSegment_new()
  */     
 int UMSegment_length(Segments segments, Segment_ID ID)
 {
-        UArray_T curr_segment = Seq_get(segments->seg_array, ID);
-        return UArray_length(curr_segment);
+        return SEGMENT_HEADER(segments->seg_array[ID])->length;
 }
 
-/* UMSegment_replace() function
+/* UMSegment_copy() function
  * Parameters:  segments: Segments type; src: Segment_ID type; dest: 
  *              Segment_ID type
  *
  * Returns:     void
  *
- * Purpose:     Replaces the segment at ID dest with the segment at ID src 
- *              in the given segment array and frees the replaced segment.
- *              Effectively copies src segment into dest segment.
+ * Purpose:     Replaces the segment at ID dest with the segment at ID src
+ *              in the given segment array and releases the replaced
+ *              segment. Effectively copies src segment into dest segment,
+ *              but the words are shared until either ID is written to
+ *              (see UMSegment_writable()), so the copy itself is O(1).
  */
 void UMSegment_copy(Segments segments, Segment_ID src, Segment_ID dest)
 {
-        UArray_T src_segment, dest_segment;
+        Word *src_words;
+
         if (src != dest) {
-                src_segment = Seq_get(segments->seg_array, src);
-                dest_segment = Seq_get(segments->seg_array, dest);
-                UArray_free(&dest_segment);
-                Seq_put(segments->seg_array, dest, NULL);
-                dest_segment = UArray_copy(src_segment, 
-                                           UArray_length(src_segment));
-                Seq_put(segments->seg_array, dest, dest_segment);
+                src_words = segments->seg_array[src];
+                SEGMENT_HEADER(src_words)->refs++;
+                release_segment(segments, segments->seg_array[dest]);
+                segments->seg_array[dest] = src_words;
         }
 }
 
+/* UMSegment_equal() function
+ * Parameters:  segments: Segments type; a: Segment_ID type; b:
+ *              Segment_ID type
+ *
+ * Returns:     true if segments a and b hold the same words: int type
+ *
+ * Purpose:     Compares two segments, at no cost when they share their
+ *              words. Lets LOADP tell when the segment it loads is the
+ *              one that is already running.
+ */
+int UMSegment_equal(Segments segments, Segment_ID a, Segment_ID b)
+{
+        Word *words_a = segments->seg_array[a];
+        Word *words_b = segments->seg_array[b];
+        Word length = SEGMENT_HEADER(words_a)->length;
+
+        if (words_a == words_b)
+                return 1;
+        return length == SEGMENT_HEADER(words_b)->length &&
+               memcmp(words_a, words_b, length * sizeof(Word)) == 0;
+}
+
+/* UMSegment_unshare() function
+ * Parameters:  segments: Segments type; ID: Segment_ID type
+ *
+ * Returns:     Pointer to the words of segment ID
+ *
+ * Purpose:     Gives segment ID its own private copy of words it shares
+ *              with other IDs and returns the copy. Called through
+ *              UMSegment_writable() before a shared segment is written.
+ */
+Word *UMSegment_unshare(Segments segments, Segment_ID ID)
+{
+        Word *shared = segments->seg_array[ID];
+        int length = SEGMENT_HEADER(shared)->length;
+        Word *words = new_segment(segments, length);
+
+        memcpy(words, shared, (size_t) length * sizeof(Word));
+        release_segment(segments, shared);
+        segments->seg_array[ID] = words;
+        return words;
+}
+
 /* UMSegment_map() function
  * Parameters:  segments: Segments type; size: int type; registers: 
  *              Register * type; b: Register type
@@ -106,29 +630,48 @@ void UMSegment_copy(Segments segments, Segment_ID src, Segment_ID dest)
  *
  * Purpose:     Maps a new segment of length size in the given segment
  *              array. If there are available IDs in the segment array, maps 
- *              the new segment at the first available ID. Otherwise maps the 
- *              new segment at ID n where n = length of segment array pre-
- *              mapping. If not mapping segment 0, places the newly mapped
- *              segment ID into register b in the given register array.
+ *              the new segment at the most recently freed ID. Otherwise
+ *              maps the new segment at ID n where n = length of segment
+ *              array pre-mapping. If not mapping segment 0, places the
+ *              newly mapped segment ID into register b in the given
+ *              register array. Compacts the arena first if enough of it
+ *              is free.
  */
 void UMSegment_map(Segments segments, int size, Register *registers, 
                    Register b) {
-        int available_ID = Seq_length(segments->available_IDs);
+        struct Segment_arena *arena = segments->arena;
         Segment_ID ID;
-        if (available_ID) {
-                ID = (Segment_ID)(uintptr_t) Seq_get(segments->available_IDs, 
-                                         available_ID - 1);
-                Seq_put(segments->seg_array, ID, new_segment(size));
-                Seq_remhi(segments->available_IDs);
-                if (registers != NULL)
-                        UMRegister_put(registers, b, ID);
-                return;
-        } else {
-                ID = Seq_length(segments->seg_array);
-                Seq_addhi(segments->seg_array, new_segment(size));
-                if (registers != NULL)
-                        UMRegister_put(registers, b, ID);
-        }
+
+        if (arena != NULL && arena->free_words >= COMPACT_MIN_WORDS &&
+            arena->free_words >= arena->top / 2)
+                compact(segments);
+        ID = next_ID(segments);
+
+        segments->seg_array[ID] = new_segment(segments, size);
+        if (registers != NULL)
+                UMRegister_put(registers, b, ID);
+}
+
+/* UMSegment_adopt() function
+ * Parameters:  segments: Segments type; mapping: void * type; length:
+ *              size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Maps the segment stored at the start of the given private
+ *              mapping, a Segment_header followed by its words, at the
+ *              next ID without copying it. The mapping becomes the
+ *              table's image, like a restored snapshot: the segment is
+ *              written in place and never freed or pooled, and the
+ *              mapping is unmapped with the table. A table has at most
+ *              one image.
+ */
+void UMSegment_adopt(Segments segments, void *mapping, size_t length)
+{
+        segments->image = mapping;
+        segments->image_length = length;
+        segments->seg_array[next_ID(segments)] =
+                (Word *) ((Segment_header *) mapping + 1);
 }
 
 /* UMSegment_unmap() function
@@ -137,17 +680,20 @@ void UMSegment_map(Segments segments, int size, Register *registers,
  * Returns:     void
  *
  * Purpose:     Unmaps the segment with ID ID in the given segment array. 
- *              Frees memory associated with the segment and adds the ID 
- *              to the available_IDs sequence of the segment array 
- *              for future reuse. 
+ *              Frees memory associated with the segment and pushes the ID
+ *              onto the available_IDs stack of the segment array for
+ *              future reuse.
  */     
 void UMSegment_unmap(Segments segments, Segment_ID ID)
 {
         if (ID != 0) {
-                UArray_T curr_segment = Seq_get(segments->seg_array, ID);
-                UArray_free(&curr_segment);
-                Seq_put(segments->seg_array, ID, NULL);
-                Seq_addhi(segments->available_IDs, (void *)(uintptr_t) ID);
+                release_segment(segments, segments->seg_array[ID]);
+                segments->seg_array[ID] = NULL;
+                if (segments->num_available == segments->available_capacity)
+                        grow((void **) &segments->available_IDs,
+                             &segments->available_capacity,
+                             sizeof(Segment_ID));
+                segments->available_IDs[segments->num_available++] = ID;
         }
 }
 
@@ -157,23 +703,40 @@ void UMSegment_unmap(Segments segments, Segment_ID ID)
  * Returns:     void
  *
  * Purpose:     Frees the memory associated with the given segment array.
- *              Iterates over the array to only free segments that have 
- *              not already been unmapped.
- */     
+ *              Iterates over the array to only free segments that have
+ *              not already been unmapped, freeing shared segments once,
+ *              then frees the pooled segments and unmaps the arena and
+ *              the snapshot image, if any.
+ */
 void UMSegment_free(Segments segments)
 {
-        int i;
-        int num_segs = Seq_length(segments->seg_array);
-        UArray_T curr_segment;
+        struct Segment_pool *pool = segments->pool;
+        uint32_t i, class;
+        Word *words;
 
-        for (i = 0; i < num_segs; i++) {
-                curr_segment = Seq_get(segments->seg_array, i);
-                if (curr_segment != NULL) {
-                        UArray_free(&curr_segment);
-                }
+        for (i = 0; i < segments->num_segs; i++) {
+                words = segments->seg_array[i];
+                if (words != NULL && --SEGMENT_HEADER(words)->refs == 0 &&
+                    !in_image(segments, words) &&
+                    !in_arena(segments->arena, words))
+                        free(SEGMENT_HEADER(words));
+        }
+        for (class = 0; class < NUM_CLASSES; class++) {
+                for (i = 0; i < pool->count[class]; i++)
+                        free(SEGMENT_HEADER(pool->blocks[class][i]));
+                free(pool->blocks[class]);
+        }
+        free(pool);
+        if (segments->arena != NULL) {
+                for (class = 0; class < ARENA_CLASSES; class++)
+                        free(segments->arena->free_blocks[class]);
+                munmap(segments->arena->base, ARENA_RESERVE);
+                free(segments->arena);
         }
-        Seq_free(&segments->seg_array);
-        Seq_free(&segments->available_IDs);
+        if (segments->image != NULL)
+                munmap(segments->image, segments->image_length);
+        free(segments->seg_array);
+        free(segments->available_IDs);
         free(segments);
 }
 
@@ -188,10 +751,7 @@ void UMSegment_free(Segments segments)
  */
 Word UMSegment_at(Segments segments, Segment_ID ID, int address)
 {
-        UArray_T curr_segment = Seq_get(segments->seg_array, ID);
-        Word *word = (uint32_t *)(curr_segment->elems + (address * curr_segment->size));
-                        //UArray_at(curr_segment, address);
-        return *word;
+        return segments->seg_array[ID][address];
 }
 
 /* UMSegment_insert() function
@@ -203,13 +763,10 @@ Word UMSegment_at(Segments segments, Segment_ID ID, int address)
  * Purpose:     Inserts the given value into the segment in the given 
  *              segment array at ID ID at address address. 
  */
-void UMSegment_insert(Segments segments, Segment_ID ID, int address, 
+void UMSegment_insert(Segments segments, Segment_ID ID, int address,
                       Word value)
 {
-        UArray_T curr_segment = Seq_get(segments->seg_array, ID);
-        Word *word = (uint32_t *)(curr_segment->elems + (address * curr_segment->size));
-                        //UArray_at(curr_segment, address);
-        *word = value;
+        UMSegment_writable(segments, ID)[address] = value;
 }
 
 /* UMSegment_type() function
@@ -229,6 +786,71 @@ Word UMSegment_remove(Segments segments, Segment_ID ID, int address)
         return prev;
 }
 
+/* UMSegment_hash() function
+ * Parameters:  segments: Segments type; ID: Segment_ID type
+ *
+ * Returns:     uint64_t
+ *
+ * Purpose:     Returns a 64-bit FNV-1a hash of the length and words of
+ *              the segment with ID ID, or 0 if the ID is unmapped or out
+ *              of range. Segments with equal contents hash alike however
+ *              they are stored.
+ */
+uint64_t UMSegment_hash(Segments segments, Segment_ID ID)
+{
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        Word *words;
+        Word i, length;
+
+        if (ID >= segments->num_segs || segments->seg_array[ID] == NULL)
+                return 0;
+        words = segments->seg_array[ID];
+        length = SEGMENT_HEADER(words)->length;
+        hash = (hash ^ length) * 0x100000001b3ULL;
+        for (i = 0; i < length; i++)
+                hash = (hash ^ words[i]) * 0x100000001b3ULL;
+        return hash;
+}
+
+/* UMSegment_set_backend() function
+ * Parameters:  backend: UMSegment_backend type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Sets where the segments of tables created from then on
+ *              are kept: each on its own heap allocation, reusing freed
+ *              ones by size class (UMSEGMENT_HEAP, the default), or in
+ *              one compacted arena per table (UMSEGMENT_ARENA), backed
+ *              by transparent huge pages if the system has them
+ *              (UMSEGMENT_ARENA_HUGE). Meant to be called once, before
+ *              any UM is created.
+ */
+void UMSegment_set_backend(UMSegment_backend backend)
+{
+        default_backend = backend;
+}
+
+/* UMSegment_backend_named() function
+ * Parameters:  name: const char * type; backend: UMSegment_backend *
+ *              type
+ *
+ * Returns:     true if name is "heap", "arena" or "huge", the name of
+ *              the backend stored in *backend: int type
+ */
+int UMSegment_backend_named(const char *name, UMSegment_backend *backend)
+{
+        unsigned i;
+
+        for (i = 0; i < sizeof(backend_names) / sizeof(backend_names[0]);
+             i++) {
+                if (strcmp(name, backend_names[i]) == 0) {
+                        *backend = (UMSegment_backend) i;
+                        return 1;
+                }
+        }
+        return 0;
+}
+
 #define NUM_REGS 8
 
 /*******************************************************
@@ -1,15 +1,8 @@
 #ifndef UM_INSTRUCTIONS
 #define UM_INSTRUCTIONS
 
+#include <stddef.h>
 #include <stdint.h>
-#include "seq.h"
-#include "uarray.h"
-
-struct UArray_T {
-        int length;
-        int size;
-        char *elems;
-};
 
 typedef uint32_t Register;
 
@@ -29,6 +22,47 @@ typedef uint32_t Word;
 
 typedef struct Segments *Segments;
 
+/* The segment table. seg_array[ID] points to the first word of segment
+ * ID, or is NULL if the ID is unmapped. Every segment is preceded by a
+ * Segment_header holding its length and the number of IDs sharing it.
+ * Segments are shared copy-on-write after LOADP, so anything that writes
+ * into a segment must get its words from UMSegment_writable(). Unmapped
+ * IDs are kept on the available_IDs stack for reuse, and unmapped
+ * segments in a size-class pool private to Um_instructions.c. Segments
+ * restored from a snapshot live inside the mapped snapshot file
+ * [image, image + image_length) rather than on the heap, and are never
+ * freed or pooled; so does a program's segment 0 when it is mapped from
+ * a cached program image (see Um_image.h). With the arena backend (see
+ * UMSegment_set_backend()), segments live in one mapping per table
+ * that is compacted from time to time, so pointers to segment words
+ * must not be kept across a MAP. The table is public so that the UM
+ * can reach segment words with a single indexed load.
+ */
+typedef struct Segment_header {
+        Word length;
+        Word refs;
+} Segment_header;
+
+#define SEGMENT_HEADER(words) ((Segment_header *) (words) - 1)
+
+struct Segments {
+        Word **seg_array;
+        uint32_t num_segs;
+        uint32_t seg_capacity;
+        Segment_ID *available_IDs;
+        uint32_t num_available;
+        uint32_t available_capacity;
+        struct Segment_pool *pool;
+        char *image;
+        size_t image_length;
+        struct Segment_arena *arena;
+};
+
+/* Where the segments of a table are kept */
+typedef enum UMSegment_backend {
+        UMSEGMENT_HEAP, UMSEGMENT_ARENA, UMSEGMENT_ARENA_HUGE
+} UMSegment_backend;
+
 Segments UMSegment_new();
 int UMSegment_length(Segments segments, Segment_ID ID);
 void UMSegment_map(Segments segments, int size, Register *registers, 
@@ -40,5 +74,27 @@ void UMSegment_free(Segments segments);
 void UMSegment_insert(Segments segments, Segment_ID ID, int address, 
                       Word value);
 Word UMSegment_remove(Segments segments, Segment_ID ID, int address);
+int UMSegment_equal(Segments segments, Segment_ID a, Segment_ID b);
+Word *UMSegment_unshare(Segments segments, Segment_ID ID);
+void UMSegment_adopt(Segments segments, void *mapping, size_t length);
+uint64_t UMSegment_hash(Segments segments, Segment_ID ID);
+void UMSegment_set_backend(UMSegment_backend backend);
+int UMSegment_backend_named(const char *name, UMSegment_backend *backend);
+
+/* UMSegment_writable() function
+ * Parameters:  segments: Segments type; ID: Segment_ID type
+ *
+ * Returns:     Pointer to the words of segment ID, safe to write to
+ *
+ * Purpose:     Returns the words of segment ID, first giving the ID a
+ *              private copy if its words are shared with another ID.
+ */
+static inline Word *UMSegment_writable(Segments segments, Segment_ID ID)
+{
+        Word *words = segments->seg_array[ID];
+        if (SEGMENT_HEADER(words)->refs > 1)
+                words = UMSegment_unshare(segments, ID);
+        return words;
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,697 @@
+/*******************************************************
+ *
+ *      Um_jit.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_jit.c contains the implementation of the UM JIT module.
+ *      Blocks are emitted into one mmap'd code cache and indexed by
+ *      their starting program counter. The cache is never writable and
+ *      executable at once: the pages a block is emitted into are made
+ *      writable for the emission and executable again before the block
+ *      can run. UM register i lives in host register r(8 + i) for the
+ *      whole block; rbx holds the UM register array and rbp the helper
+ *      context. When the code cache fills up, every translation is
+ *      dropped and the cache is reused from the start.
+ *
+ *      Code that is overwritten after it was translated is left to the
+ *      interpreter for a while before it is translated again: every
+ *      word a dropped block covered must be looked up COLD_RUNS times,
+ *      doubling each time a block over it is dropped, before a block
+ *      can start at it or run over it. Self-modifying loops thus settle
+ *      on the interpreter instead of retranslating at every store.
+ *
+ *      On hosts other than x86-64, UMJit_new() returns NULL and the UM
+ *      falls back to the interpreter.
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include "Um_jit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS AND STRUCT DEFINITIONS
+ *
+ *******************************************************/
+
+#define CACHE_SIZE (32 * 1024 * 1024)
+#define MAX_BLOCK_INSTRS 256
+#define MAX_INSTR_BYTES 160
+#define MAX_BLOCK_BYTES (128 + MAX_BLOCK_INSTRS * MAX_INSTR_BYTES)
+#define COLD_RUNS 16
+#define MAX_COLD_SHIFT 11
+
+#define NUM_REGS 8
+
+enum { CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+       NAND, HALT, MAP, UNMAP, OUT, IN, LOADP, LV };
+
+struct UM_jit {
+        UMJit_helpers helpers;
+        uint8_t *cache;
+        size_t used;
+        size_t page_size;
+        UMJit_block *blocks;
+        uint32_t *block_end;
+        uint8_t *covered;
+        uint16_t *cold;         /* lookups left before translating */
+        uint8_t *drops;         /* blocks dropped over each word */
+        uint32_t length;
+};
+
+#if defined(__x86_64__)
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* emit8(), emit32(), emit64() functions
+ * Parameters:  p: pointer to the emit position; value to emit
+ *
+ * Returns:     void
+ *
+ * Purpose:     Append a byte, a little-endian 32 bit word, or a 64 bit
+ *              word to the code being emitted and advance the position.
+ */
+static inline void emit8(uint8_t **p, uint8_t byte)
+{
+        *(*p)++ = byte;
+}
+
+static inline void emit32(uint8_t **p, uint32_t word)
+{
+        memcpy(*p, &word, sizeof(word));
+        *p += sizeof(word);
+}
+
+static inline void emit64(uint8_t **p, uint64_t word)
+{
+        memcpy(*p, &word, sizeof(word));
+        *p += sizeof(word);
+}
+
+/* modrm() function
+ * Parameters:  reg: reg field; rm: r/m field (both 0-7)
+ *
+ * Returns:     Register-direct ModRM byte
+ */
+static inline uint8_t modrm(unsigned reg, unsigned rm)
+{
+        return 0xc0 | (reg << 3) | rm;
+}
+
+/* emit_prologue() function
+ * Parameters:  p: pointer to the emit position
+ *
+ * Returns:     void
+ *
+ * Purpose:     Saves the callee-saved host registers, keeps the register
+ *              array and helper context in rbx and rbp, and loads the UM
+ *              registers into r8d-r15d.
+ */
+static void emit_prologue(uint8_t **p)
+{
+        unsigned i;
+
+        emit8(p, 0x53);                                 /* push rbx */
+        emit8(p, 0x55);                                 /* push rbp */
+        for (i = 4; i < 8; i++) {                       /* push r12-r15 */
+                emit8(p, 0x41);
+                emit8(p, 0x50 + i);
+        }
+        emit8(p, 0x48); emit8(p, 0x83); emit8(p, 0xec); /* sub rsp, 8 */
+        emit8(p, 0x08);
+        emit8(p, 0x48); emit8(p, 0x89); emit8(p, 0xfb); /* mov rbx, rdi */
+        emit8(p, 0x48); emit8(p, 0x89); emit8(p, 0xf5); /* mov rbp, rsi */
+        for (i = 0; i < NUM_REGS; i++) {       /* mov r(8+i)d, [rbx+4i] */
+                emit8(p, 0x44);
+                emit8(p, 0x8b);
+                emit8(p, 0x43 | (i << 3));
+                emit8(p, 4 * i);
+        }
+}
+
+/* emit_exit_eax() function
+ * Parameters:  p: pointer to the emit position; count: number of UM
+ *              instructions the block has run at this exit
+ *
+ * Returns:     void
+ *
+ * Purpose:     Stores the UM registers back into the register array and
+ *              returns from the block with count in the high half of
+ *              rax. The next program counter must already be in eax.
+ */
+static void emit_exit_eax(uint8_t **p, uint32_t count)
+{
+        unsigned i;
+
+        emit8(p, 0x48); emit8(p, 0xba);                 /* mov rdx, count */
+        emit64(p, (uint64_t) count << 32);
+        emit8(p, 0x48); emit8(p, 0x09); emit8(p, 0xd0); /* or rax, rdx */
+
+        for (i = 0; i < NUM_REGS; i++) {       /* mov [rbx+4i], r(8+i)d */
+                emit8(p, 0x44);
+                emit8(p, 0x89);
+                emit8(p, 0x43 | (i << 3));
+                emit8(p, 4 * i);
+        }
+        emit8(p, 0x48); emit8(p, 0x83); emit8(p, 0xc4); /* add rsp, 8 */
+        emit8(p, 0x08);
+        for (i = 8; i-- > 4; ) {                        /* pop r15-r12 */
+                emit8(p, 0x41);
+                emit8(p, 0x58 + i);
+        }
+        emit8(p, 0x5d);                                 /* pop rbp */
+        emit8(p, 0x5b);                                 /* pop rbx */
+        emit8(p, 0xc3);                                 /* ret */
+}
+
+/* emit_exit() function
+ * Parameters:  p: pointer to the emit position; pc: uint32_t type;
+ *              start: program counter of the block
+ *
+ * Returns:     void
+ *
+ * Purpose:     Emits a block exit that continues at program counter pc,
+ *              having run every instruction from start up to pc.
+ */
+static void emit_exit(uint8_t **p, uint32_t pc, uint32_t start)
+{
+        emit8(p, 0xb8);                                 /* mov eax, pc */
+        emit32(p, pc);
+        emit_exit_eax(p, pc - start);
+}
+
+/* emit_skip_exit() function
+ * Parameters:  p: pointer to the emit position; jcc: short jump opcode;
+ *              pc: uint32_t type; start: program counter of the block
+ *
+ * Returns:     void
+ *
+ * Purpose:     Emits a block exit to pc guarded by a short conditional
+ *              jump that skips over it. The exit is taken when the
+ *              condition of jcc is false.
+ */
+static void emit_skip_exit(uint8_t **p, uint8_t jcc, uint32_t pc,
+                           uint32_t start)
+{
+        uint8_t *patch;
+
+        emit8(p, jcc);
+        patch = *p;
+        emit8(p, 0);
+        emit_exit(p, pc, start);
+        *patch = (uint8_t) (*p - patch - 1);
+}
+
+/* emit_eax_from(), emit_eax_to() functions
+ * Parameters:  p: pointer to the emit position; r: UM register
+ *
+ * Returns:     void
+ *
+ * Purpose:     Move a UM register into eax, or eax into a UM register.
+ */
+static inline void emit_eax_from(uint8_t **p, unsigned r)
+{
+        emit8(p, 0x44); emit8(p, 0x89); emit8(p, modrm(r, 0));
+}
+
+static inline void emit_eax_to(uint8_t **p, unsigned r)
+{
+        emit8(p, 0x41); emit8(p, 0x89); emit8(p, modrm(0, r));
+}
+
+/* emit_call() function
+ * Parameters:  p: pointer to the emit position; fn: address of helper;
+ *              nargs: number of UM register arguments; args: UM registers
+ *              passed after the context, in order
+ *
+ * Returns:     void
+ *
+ * Purpose:     Calls a helper as fn(ctx, args...). The caller-saved UM
+ *              registers r8d-r11d are preserved around the call and the
+ *              helper result is left in eax.
+ */
+static void emit_call(uint8_t **p, uint64_t fn, int nargs, const unsigned *args)
+{
+        static const unsigned arg_regs[] = { 6, 2, 1 };  /* esi, edx, ecx */
+        int i;
+
+        for (i = 0; i < 4; i++) {                       /* push r8-r11 */
+                emit8(p, 0x41);
+                emit8(p, 0x50 + i);
+        }
+        emit8(p, 0x48); emit8(p, 0x89); emit8(p, 0xef); /* mov rdi, rbp */
+        for (i = 0; i < nargs; i++) {
+                emit8(p, 0x44);
+                emit8(p, 0x89);
+                emit8(p, modrm(args[i], arg_regs[i]));
+        }
+        emit8(p, 0x48); emit8(p, 0xb8);                 /* mov rax, fn */
+        emit64(p, fn);
+        emit8(p, 0xff); emit8(p, 0xd0);                 /* call rax */
+        for (i = 4; i-- > 0; ) {                        /* pop r11-r8 */
+                emit8(p, 0x41);
+                emit8(p, 0x58 + i);
+        }
+}
+
+/* emit_segment() function
+ * Parameters:  jit: UM_jit type; p: pointer to the emit position;
+ *              r: UM register holding a segment ID
+ *
+ * Returns:     void
+ *
+ * Purpose:     Loads the address of the words of the segment whose ID is
+ *              in UM register r into rax, from the segment table.
+ */
+static void emit_segment(UM_jit jit, uint8_t **p, unsigned r)
+{
+        emit8(p, 0x48); emit8(p, 0xb8);                 /* mov rax, table */
+        emit64(p, (uint64_t) (uintptr_t) jit->helpers.seg_array);
+        emit8(p, 0x48); emit8(p, 0x8b); emit8(p, 0x00); /* mov rax, [rax] */
+        emit8(p, 0x4a); emit8(p, 0x8b);                 /* mov rax, */
+        emit8(p, 0x04); emit8(p, 0xc0 | (r << 3));      /* [rax + 8r] */
+}
+
+/* emit_instruction() function
+ * Parameters:  jit: UM_jit type; p: pointer to the emit position;
+ *              word: UM instruction; pc: uint32_t type; start: program
+ *              counter of the block
+ *
+ * Returns:     true if the instruction ends the block
+ *
+ * Purpose:     Emits native code for one translatable UM instruction.
+ */
+static int emit_instruction(UM_jit jit, uint8_t **p, Word word, uint32_t pc,
+                            uint32_t start)
+{
+        unsigned op = word >> 28;
+        unsigned a = (word >> 6) & 7, b = (word >> 3) & 7, c = word & 7;
+        unsigned args[3];
+        uint8_t *slow, *slow_refs, *done;
+
+        switch (op) {
+        case CMOV:
+                emit8(p, 0x45); emit8(p, 0x85);        /* test rc, rc */
+                emit8(p, modrm(c, c));
+                emit8(p, 0x45); emit8(p, 0x0f);        /* cmovne ra, rb */
+                emit8(p, 0x45); emit8(p, modrm(a, b));
+                return 0;
+        case SLOAD:
+                emit_segment(jit, p, b);
+                emit8(p, 0x46); emit8(p, 0x8b);        /* mov ra, */
+                emit8(p, 0x04 | (a << 3));             /* [rax + 4rc] */
+                emit8(p, 0x80 | (c << 3));
+                return 0;
+        case SSTORE:
+                /* Segment 0 and shared segments go through the helper */
+                emit8(p, 0x45); emit8(p, 0x85);        /* test ra, ra */
+                emit8(p, modrm(a, a));
+                emit8(p, 0x74);                        /* jz slow */
+                slow = (*p)++;
+                emit_segment(jit, p, a);
+                emit8(p, 0x83); emit8(p, 0x78);        /* cmp refs, 1 */
+                emit8(p, 0xfc); emit8(p, 0x01);
+                emit8(p, 0x75);                        /* jne slow */
+                slow_refs = (*p)++;
+                emit8(p, 0x46); emit8(p, 0x89);        /* mov [rax + 4rb], */
+                emit8(p, 0x04 | (c << 3));             /* rc */
+                emit8(p, 0x80 | (b << 3));
+                emit8(p, 0xeb);                        /* jmp done */
+                done = (*p)++;
+                *slow = (uint8_t) (*p - slow - 1);
+                *slow_refs = (uint8_t) (*p - slow_refs - 1);
+                args[0] = a;
+                args[1] = b;
+                args[2] = c;
+                emit_call(p, (uint64_t) (uintptr_t) jit->helpers.sstore,
+                          3, args);
+                emit8(p, 0x85); emit8(p, 0xc0);        /* test eax, eax */
+                emit_skip_exit(p, 0x74, pc + 1, start); /* jz past exit */
+                *done = (uint8_t) (*p - done - 1);
+                return 0;
+        case ADD:
+                emit_eax_from(p, b);
+                emit8(p, 0x44); emit8(p, 0x01);        /* add eax, rc */
+                emit8(p, modrm(c, 0));
+                emit_eax_to(p, a);
+                return 0;
+        case MUL:
+                emit_eax_from(p, b);
+                emit8(p, 0x41); emit8(p, 0x0f);        /* imul eax, rc */
+                emit8(p, 0xaf); emit8(p, modrm(0, c));
+                emit_eax_to(p, a);
+                return 0;
+        case DIV:
+                /* Division by zero is left to the interpreter */
+                emit8(p, 0x45); emit8(p, 0x85);        /* test rc, rc */
+                emit8(p, modrm(c, c));
+                emit_skip_exit(p, 0x75, pc, start);    /* jnz past exit */
+                emit_eax_from(p, b);
+                emit8(p, 0x31); emit8(p, 0xd2);        /* xor edx, edx */
+                emit8(p, 0x41); emit8(p, 0xf7);        /* div rc */
+                emit8(p, modrm(6, c));
+                emit_eax_to(p, a);
+                return 0;
+        case NAND:
+                emit_eax_from(p, b);
+                emit8(p, 0x44); emit8(p, 0x21);        /* and eax, rc */
+                emit8(p, modrm(c, 0));
+                emit8(p, 0xf7); emit8(p, 0xd0);        /* not eax */
+                emit_eax_to(p, a);
+                return 0;
+        case UNMAP:
+                args[0] = c;
+                emit_call(p, (uint64_t) (uintptr_t) jit->helpers.unmap,
+                          1, args);
+                return 0;
+        case OUT:
+                args[0] = c;
+                emit_call(p, (uint64_t) (uintptr_t) jit->helpers.output,
+                          1, args);
+                return 0;
+        case LOADP:
+                /* Jumps within segment 0 stay native; replacing segment 0
+                 * is left to the interpreter. */
+                emit8(p, 0x45); emit8(p, 0x85);        /* test rb, rb */
+                emit8(p, modrm(b, b));
+                emit_skip_exit(p, 0x74, pc, start);    /* jz past exit */
+                emit_eax_from(p, c);
+                emit_exit_eax(p, pc + 1 - start);
+                return 1;
+        case LV:
+                emit8(p, 0x41);                        /* mov ra, imm32 */
+                emit8(p, 0xb8 + ((word >> 25) & 7));
+                emit32(p, word & 0x1ffffff);
+                return 0;
+        }
+        return 1;
+}
+
+/* translatable() function
+ * Parameters:  word: UM instruction
+ *
+ * Returns:     true if the JIT translates the instruction
+ */
+static inline int translatable(Word word)
+{
+        unsigned op = word >> 28;
+        return op <= LV && op != HALT && op != MAP && op != IN;
+}
+
+/* protect_cache() function
+ * Parameters:  jit: UM_jit type; start: first byte; length: size_t type;
+ *              prot: protection flags for mprotect()
+ *
+ * Returns:     void
+ *
+ * Purpose:     Sets the protection of the pages of the code cache that
+ *              hold the given bytes.
+ */
+static void protect_cache(UM_jit jit, uint8_t *start, size_t length,
+                          int prot)
+{
+        uintptr_t first = (uintptr_t) start & ~(jit->page_size - 1);
+        uintptr_t last = (uintptr_t) start + length;
+
+        if (mprotect((void *) first, last - first, prot) != 0) {
+                perror("JIT code cache");
+                exit(EXIT_FAILURE);
+        }
+}
+
+/* translate() function
+ * Parameters:  jit: UM_jit type; code: segment 0; pc: uint32_t type
+ *
+ * Returns:     Block starting at pc
+ *
+ * Purpose:     Translates the straight-line run of segment 0 starting at
+ *              pc into a new block in the code cache. The run stops
+ *              before any word that is still cold.
+ */
+static UMJit_block translate(UM_jit jit, const Word *code, uint32_t pc)
+{
+        uint8_t *start, *p;
+        uint32_t i = pc;
+        UMJit_block block;
+
+        if (jit->used + MAX_BLOCK_BYTES > CACHE_SIZE)
+                UMJit_reset(jit, jit->length);
+
+        start = p = jit->cache + jit->used;
+        protect_cache(jit, start, MAX_BLOCK_BYTES, PROT_READ | PROT_WRITE);
+        emit_prologue(&p);
+        while (1) {
+                if (i >= jit->length || i - pc >= MAX_BLOCK_INSTRS ||
+                    !translatable(code[i]) || (i > pc && jit->cold[i])) {
+                        emit_exit(&p, i, pc);
+                        break;
+                }
+                if (emit_instruction(jit, &p, code[i], i, pc)) {
+                        i++;
+                        break;
+                }
+                i++;
+        }
+        protect_cache(jit, start, MAX_BLOCK_BYTES, PROT_READ | PROT_EXEC);
+        jit->used += p - start;
+        jit->used = (jit->used + 15) & ~(size_t) 15;
+
+        memcpy(&block, &start, sizeof(block));
+        jit->blocks[pc] = block;
+        jit->block_end[pc] = i;
+        memset(jit->covered + pc, 1, i - pc);
+        return block;
+}
+
+/*******************************************************
+ *
+ *      PUBLIC MEMBER FUNCTIONS
+ *
+ *******************************************************/
+
+/* UMJit_new() function
+ * Parameters:  helpers: UMJit_helpers type
+ *
+ * Returns:     New UM_jit, or NULL if no executable memory is available
+ *
+ * Purpose:     Allocates an empty JIT with its code cache, which starts
+ *              out executable and is only made writable, a few pages at a
+ *              time, while a block is emitted. Translated code calls back
+ *              into the UM through the given helpers.
+ */
+UM_jit UMJit_new(UMJit_helpers helpers)
+{
+        UM_jit jit = malloc(sizeof(struct UM_jit));
+        if (jit == NULL)
+                return NULL;
+        jit->cache = mmap(NULL, CACHE_SIZE, PROT_READ | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (jit->cache == MAP_FAILED) {
+                free(jit);
+                return NULL;
+        }
+        jit->helpers = helpers;
+        jit->used = 0;
+        jit->page_size = (size_t) sysconf(_SC_PAGESIZE);
+        jit->blocks = NULL;
+        jit->block_end = NULL;
+        jit->covered = NULL;
+        jit->cold = NULL;
+        jit->drops = NULL;
+        jit->length = 0;
+        return jit;
+}
+
+/* UMJit_free() function
+ * Parameters:  jit: UM_jit type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Frees the code cache and all memory of the given JIT.
+ */
+void UMJit_free(UM_jit jit)
+{
+        if (jit == NULL)
+                return;
+        munmap(jit->cache, CACHE_SIZE);
+        free(jit->blocks);
+        free(jit->block_end);
+        free(jit->covered);
+        free(jit->cold);
+        free(jit->drops);
+        free(jit);
+}
+
+/* UMJit_reset() function
+ * Parameters:  jit: UM_jit type; length: length of segment 0
+ *
+ * Returns:     void
+ *
+ * Purpose:     Drops every translation and empties the code cache. Called
+ *              whenever segment 0 is replaced by a different program,
+ *              with its new length, which also forgets which code was
+ *              overwritten, and when the cache is full.
+ */
+void UMJit_reset(UM_jit jit, uint32_t length)
+{
+        if (length != jit->length || jit->blocks == NULL) {
+                free(jit->blocks);
+                free(jit->block_end);
+                free(jit->covered);
+                free(jit->cold);
+                free(jit->drops);
+                jit->blocks = malloc((length + 1) * sizeof(UMJit_block));
+                jit->block_end = malloc((length + 1) * sizeof(uint32_t));
+                jit->covered = malloc(length + 1);
+                jit->cold = malloc((length + 1) * sizeof(uint16_t));
+                jit->drops = malloc(length + 1);
+                if (jit->blocks == NULL || jit->block_end == NULL ||
+                    jit->covered == NULL || jit->cold == NULL ||
+                    jit->drops == NULL) {
+                        fprintf(stderr, "Out of memory in JIT\n");
+                        exit(EXIT_FAILURE);
+                }
+                jit->length = length;
+        }
+        memset(jit->blocks, 0, (length + 1) * sizeof(UMJit_block));
+        memset(jit->covered, 0, length + 1);
+        memset(jit->cold, 0, (length + 1) * sizeof(uint16_t));
+        memset(jit->drops, 0, length + 1);
+        jit->used = 0;
+}
+
+/* UMJit_invalidate() function
+ * Parameters:  jit: UM_jit type; lo: uint32_t type; hi: uint32_t type
+ *
+ * Returns:     true if any translation was dropped
+ *
+ * Purpose:     Drops the translations of every block that covers a word
+ *              in [lo, hi) of segment 0 and makes every word those blocks
+ *              covered cold (see the top of this file). Words no block
+ *              was ever built over (typically data kept in segment 0) are
+ *              skipped without a search. The code of dropped blocks stays
+ *              in the cache until the next reset, so a block that has
+ *              just written into itself can still return safely.
+ */
+int UMJit_invalidate(UM_jit jit, uint32_t lo, uint32_t hi)
+{
+        uint32_t start = lo > MAX_BLOCK_INSTRS ? lo - MAX_BLOCK_INSTRS : 0;
+        uint32_t i, j;
+        int dropped = 0;
+
+        if (hi > jit->length)
+                hi = jit->length;
+        for (i = lo; i < hi && !jit->covered[i]; i++)
+                ;
+        if (i == hi)
+                return 0;
+        for (i = start; i < hi; i++) {
+                if (jit->blocks[i] == NULL || jit->block_end[i] <= lo)
+                        continue;
+                for (j = i; j < jit->block_end[i]; j++) {
+                        if (jit->drops[j] < MAX_COLD_SHIFT)
+                                jit->drops[j]++;
+                        jit->cold[j] = COLD_RUNS << jit->drops[j];
+                }
+                jit->blocks[i] = NULL;
+                dropped = 1;
+        }
+        memset(jit->covered + lo, 0, hi - lo);
+        return dropped;
+}
+
+/* UMJit_lookup() function
+ * Parameters:  jit: UM_jit type; code: segment 0; pc: uint32_t type
+ *
+ * Returns:     Block starting at pc, or NULL
+ *
+ * Purpose:     Returns the translation of the run starting at pc,
+ *              translating it first if needed. Returns NULL when the
+ *              instruction at pc must be run by the interpreter, which
+ *              includes every lookup of a cold word but the one that
+ *              makes it hot again.
+ */
+UMJit_block UMJit_lookup(UM_jit jit, const Word *code, uint32_t pc)
+{
+        if (pc >= jit->length)
+                return NULL;
+        if (jit->blocks[pc] != NULL)
+                return jit->blocks[pc];
+        if (jit->cold[pc] > 0) {
+                jit->cold[pc]--;
+                return NULL;
+        }
+        if (!translatable(code[pc]))
+                return NULL;
+        return translate(jit, code, pc);
+}
+
+/* UMJit_length() function
+ * Parameters:  jit: UM_jit type; pc: uint32_t type
+ *
+ * Returns:     Number of instructions in the block starting at pc, or 0
+ *
+ * Purpose:     Tells the most instructions a call of the block starting
+ *              at pc can run, so that the UM can keep to a budget.
+ */
+uint32_t UMJit_length(UM_jit jit, uint32_t pc)
+{
+        if (pc >= jit->length || jit->blocks[pc] == NULL)
+                return 0;
+        return jit->block_end[pc] - pc;
+}
+
+#else /* !__x86_64__ */
+
+UM_jit UMJit_new(UMJit_helpers helpers)
+{
+        (void) helpers;
+        return NULL;
+}
+
+void UMJit_free(UM_jit jit)
+{
+        (void) jit;
+}
+
+void UMJit_reset(UM_jit jit, uint32_t length)
+{
+        (void) jit;
+        (void) length;
+}
+
+int UMJit_invalidate(UM_jit jit, uint32_t lo, uint32_t hi)
+{
+        (void) jit;
+        (void) lo;
+        (void) hi;
+        return 0;
+}
+
+UMJit_block UMJit_lookup(UM_jit jit, const Word *code, uint32_t pc)
+{
+        (void) jit;
+        (void) code;
+        (void) pc;
+        return NULL;
+}
+
+uint32_t UMJit_length(UM_jit jit, uint32_t pc)
+{
+        (void) jit;
+        (void) pc;
+        return 0;
+}
+
+#endif /* __x86_64__ */
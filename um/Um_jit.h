@@ -0,0 +1,57 @@
+/*******************************************************
+ *
+ *      Um_jit.h
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_jit.h contains the interface of the UM JIT module. The JIT
+ *      translates straight-line runs of segment 0 into native x86-64
+ *      code with the eight UM registers held in host registers. Each
+ *      translated run (a block) is called as a function and returns the
+ *      program counter at which execution must continue, together with
+ *      the number of UM instructions it ran (see UMJIT_PC() and
+ *      UMJIT_COUNT()), which is less than its length when it returns
+ *      early. Instructions the JIT does not translate (HALT, IN, MAP,
+ *      and LOADP from a segment other than 0) are left to the
+ *      interpreter.
+ *
+ *      SLOAD, and SSTORE into a segment other than 0 whose words are not
+ *      shared, read and write segments through the segment table given
+ *      to UMJit_new(). Other stores, UNMAP and OUT call back into the UM
+ *      through the helpers. The SSTORE helper must return nonzero when
+ *      its store dropped a translation (see UMJit_invalidate()), in
+ *      which case the block returns right after the store since it may
+ *      itself have been overwritten. A DIV by zero also ends the block,
+ *      before the DIV.
+ *
+ *******************************************************/
+
+#ifndef UM_JIT
+#define UM_JIT
+
+#include <stdint.h>
+#include "Um_instructions.h"
+
+typedef struct UM_jit *UM_jit;
+
+typedef uint64_t (*UMJit_block)(Word *registers, void *ctx);
+
+/* The two halves of what a block returns */
+#define UMJIT_PC(result) ((uint32_t) (result))
+#define UMJIT_COUNT(result) ((uint32_t) ((result) >> 32))
+
+typedef struct UMJit_helpers {
+        Word ***seg_array;
+        int (*sstore)(void *ctx, Word seg, Word address, Word value);
+        void (*unmap)(void *ctx, Word seg);
+        void (*output)(void *ctx, Word c);
+} UMJit_helpers;
+
+UM_jit UMJit_new(UMJit_helpers helpers);
+void UMJit_free(UM_jit jit);
+void UMJit_reset(UM_jit jit, uint32_t length);
+int UMJit_invalidate(UM_jit jit, uint32_t lo, uint32_t hi);
+UMJit_block UMJit_lookup(UM_jit jit, const Word *code, uint32_t pc);
+uint32_t UMJit_length(UM_jit jit, uint32_t pc);
+
+#endif
@@ -0,0 +1,353 @@
+/*******************************************************
+ *
+ *      Um_load.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_load.c contains the implementation of the UM program loader.
+ *      The image is mmap'd read-only and byte-swapped straight into the
+ *      storage of segment 0, so no copy of a regular file is held on the
+ *      stack or in a temporary buffer. On x86-64 the byte swap uses a
+ *      pshufb kernel (AVX2 when the CPU has it, otherwise SSSE3), chosen
+ *      once at run time; other hosts use the portable scalar loop.
+ *
+ *      Inputs that are not regular files, such as pipes, have no size to
+ *      map: they are read to the end with read(2) into a buffer that is
+ *      then swapped into segment 0. Regular files that cannot be mmap'd
+ *      are read into segment 0 and swapped in place. Images of more than
+ *      INT_MAX words are rejected, as no segment can hold them.
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include "Um_load.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS
+ *
+ *******************************************************/
+
+#define CODE_SEG 0
+
+#define THREE_BYTES 24
+#define ONE_BYTE 8
+#define LOW_ORDER_MASK 0xff
+#define HIGH_ORDER_MASK 0xff000000
+#define MID_HIGH_ORDER_MASK 0xff0000
+#define MID_LOW_ORDER_MASK 0xff00
+
+#define READ_CHUNK (64 * 1024)
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* swap_endian() function
+ * Parameters:  word: uint32_t type
+ *
+ * Returns:     Word with swapped endian: uint32_t type
+ *
+ * Purpose:     Swaps the endian-ness of the given uint32_t and returns
+ *              the result.
+ */
+static inline uint32_t swap_endian(uint32_t word)
+{
+        return ((word >> THREE_BYTES) & LOW_ORDER_MASK) |
+                ((word << ONE_BYTE) & MID_HIGH_ORDER_MASK) |
+                ((word >> ONE_BYTE) & MID_LOW_ORDER_MASK) |
+                ((word << THREE_BYTES) & HIGH_ORDER_MASK);
+}
+
+/* swap_scalar() function
+ * Parameters:  dst: Word * type; src: const Word * type;
+ *              num_words: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Byte-swaps num_words words from src into dst one at a
+ *              time. dst may equal src.
+ */
+static void swap_scalar(Word *dst, const Word *src, size_t num_words)
+{
+        size_t i;
+
+        for (i = 0; i < num_words; i++)
+                dst[i] = swap_endian(src[i]);
+}
+
+#if defined(__x86_64__)
+
+/* swap_ssse3() function
+ * Parameters:  dst: Word * type; src: const Word * type;
+ *              num_words: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Byte-swaps four words per pshufb, finishing the tail
+ *              with swap_scalar(). dst may equal src.
+ */
+__attribute__((target("ssse3")))
+static void swap_ssse3(Word *dst, const Word *src, size_t num_words)
+{
+        const __m128i mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                           11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i;
+
+        for (i = 0; i + 4 <= num_words; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+                _mm_storeu_si128((__m128i *)(dst + i),
+                                 _mm_shuffle_epi8(v, mask));
+        }
+        swap_scalar(dst + i, src + i, num_words - i);
+}
+
+/* swap_avx2() function
+ * Parameters:  dst: Word * type; src: const Word * type;
+ *              num_words: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Byte-swaps sixteen words per iteration with two 256-bit
+ *              pshufbs, finishing the tail with swap_scalar(). dst may
+ *              equal src.
+ */
+__attribute__((target("avx2")))
+static void swap_avx2(Word *dst, const Word *src, size_t num_words)
+{
+        const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                              11, 10, 9, 8, 15, 14, 13, 12,
+                                              3, 2, 1, 0, 7, 6, 5, 4,
+                                              11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i;
+
+        for (i = 0; i + 16 <= num_words; i += 16) {
+                __m256i v0 = _mm256_loadu_si256((const __m256i *)(src + i));
+                __m256i v1 = _mm256_loadu_si256((const __m256i *)
+                                                (src + i + 8));
+                _mm256_storeu_si256((__m256i *)(dst + i),
+                                    _mm256_shuffle_epi8(v0, mask));
+                _mm256_storeu_si256((__m256i *)(dst + i + 8),
+                                    _mm256_shuffle_epi8(v1, mask));
+        }
+        swap_scalar(dst + i, src + i, num_words - i);
+}
+
+/* The kernel UMLoad_swap() uses, chosen once by choose_kernel() */
+static void (*kernel)(Word *, const Word *, size_t);
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/* choose_kernel() function
+ * Parameters:  none
+ *
+ * Returns:     void
+ *
+ * Purpose:     Sets kernel to the widest byte-swap kernel the CPU
+ *              supports. Run through pthread_once(), so loaders on
+ *              several threads agree on it.
+ */
+static void choose_kernel(void)
+{
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+                kernel = swap_avx2;
+        else if (__builtin_cpu_supports("ssse3"))
+                kernel = swap_ssse3;
+        else
+                kernel = swap_scalar;
+}
+
+#endif /* __x86_64__ */
+
+/* read_words() function
+ * Parameters:  fd: int type; dst: Word * type; num_words: size_t type
+ *
+ * Returns:     true if all num_words words were read: int type
+ *
+ * Purpose:     Reads num_words raw words from fd into dst, retrying
+ *              short reads. Used when the image cannot be mmap'd.
+ */
+static int read_words(int fd, Word *dst, size_t num_words)
+{
+        char *p = (char *) dst;
+        size_t left = num_words * sizeof(Word);
+        ssize_t n;
+
+        while (left > 0) {
+                n = read(fd, p, left);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return 0;
+                p += n;
+                left -= (size_t) n;
+        }
+        return 1;
+}
+
+/* read_stream() function
+ * Parameters:  fd: int type; num_bytes: size_t * type
+ *
+ * Returns:     A malloc'd buffer holding everything up to the end of fd,
+ *              or NULL if reading failed
+ *
+ * Purpose:     Reads an input of unknown size, such as a pipe, growing
+ *              the buffer as it goes. Stores its length in *num_bytes.
+ *              The caller frees the result.
+ */
+static char *read_stream(int fd, size_t *num_bytes)
+{
+        size_t length = 0, capacity = READ_CHUNK;
+        char *buffer = malloc(capacity), *grown;
+        ssize_t n;
+
+        while (buffer != NULL) {
+                if (length == capacity) {
+                        capacity *= 2;
+                        grown = realloc(buffer, capacity);
+                        if (grown == NULL)
+                                break;
+                        buffer = grown;
+                }
+                n = read(fd, buffer + length, capacity - length);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        break;
+                if (n == 0) {
+                        *num_bytes = length;
+                        return buffer;
+                }
+                length += (size_t) n;
+        }
+        free(buffer);
+        return NULL;
+}
+
+/* map_code() function
+ * Parameters:  segments: Segments type; num_words: size_t type;
+ *              program: const char * type
+ *
+ * Returns:     Pointer to the words of the new segment 0
+ *
+ * Purpose:     Maps segment 0 with room for num_words words. Exits with
+ *              an error message if the image is too large for a segment.
+ */
+static Word *map_code(Segments segments, size_t num_words,
+                      const char *program)
+{
+        if (num_words > INT_MAX) {
+                fprintf(stderr, "Program %s is too large\n", program);
+                exit(EXIT_FAILURE);
+        }
+        UMSegment_map(segments, (int) num_words, NULL, 0);
+        return segments->seg_array[CODE_SEG];
+}
+
+/*******************************************************
+ *
+ *      PUBLIC FUNCTIONS
+ *
+ *******************************************************/
+
+/* UMLoad_swap() function
+ * Parameters:  dst: Word * type; src: const Word * type;
+ *              num_words: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Converts num_words big-endian words at src to host byte
+ *              order at dst, using the widest byte-swap kernel the CPU
+ *              supports. dst may equal src.
+ */
+void UMLoad_swap(Word *dst, const Word *src, size_t num_words)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        if (dst != src)
+                memmove(dst, src, num_words * sizeof(Word));
+#elif defined(__x86_64__)
+        pthread_once(&kernel_once, choose_kernel);
+        kernel(dst, src, num_words);
+#else
+        swap_scalar(dst, src, num_words);
+#endif
+}
+
+/* UMLoad_program() function
+ * Parameters:  segments: Segments type; program: const char * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Maps a new segment 0 in the given Segments, sized to the
+ *              number of whole words in the given file, and fills it with
+ *              the file's words in host byte order. Exits with an error
+ *              message if the file cannot be opened or read, or holds
+ *              more words than a segment can.
+ */
+void UMLoad_program(Segments segments, const char *program)
+{
+        struct stat buffer;
+        size_t num_words, num_bytes;
+        const Word *image;
+        char *stream;
+        Word *code;
+        int fd;
+
+        fd = open(program, O_RDONLY);
+        if (fd < 0 || fstat(fd, &buffer) != 0) {
+                fprintf(stderr, "Could not open file %s for reading\n",
+                        program);
+                exit(EXIT_FAILURE);
+        }
+        if (!S_ISREG(buffer.st_mode)) {
+                stream = read_stream(fd, &num_bytes);
+                if (stream == NULL) {
+                        fprintf(stderr, "Could not read %s\n", program);
+                        exit(EXIT_FAILURE);
+                }
+                num_words = num_bytes / sizeof(Word);
+                code = map_code(segments, num_words, program);
+                UMLoad_swap(code, (const Word *) stream, num_words);
+                free(stream);
+                close(fd);
+                return;
+        }
+        num_words = (size_t) buffer.st_size / sizeof(Word);
+        code = map_code(segments, num_words, program);
+        if (num_words == 0) {
+                close(fd);
+                return;
+        }
+
+        image = mmap(NULL, num_words * sizeof(Word), PROT_READ,
+                     MAP_PRIVATE, fd, 0);
+        if (image != MAP_FAILED) {
+                madvise((void *) image, num_words * sizeof(Word),
+                        MADV_SEQUENTIAL);
+                UMLoad_swap(code, image, num_words);
+                munmap((void *) image, num_words * sizeof(Word));
+        } else if (read_words(fd, code, num_words)) {
+                UMLoad_swap(code, code, num_words);
+        } else {
+                fprintf(stderr, "Could not read %s\n", program);
+                exit(EXIT_FAILURE);
+        }
+        close(fd);
+}
@@ -0,0 +1,22 @@
+/*******************************************************
+ *
+ *      Um_load.h
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_load.h contains the interface of the UM program loader. A UM
+ *      image is a sequence of big-endian 32-bit words; the loader maps
+ *      the file and converts it into segment 0 in bulk.
+ *
+ *******************************************************/
+
+#ifndef UM_LOAD
+#define UM_LOAD
+
+#include <stddef.h>
+#include "Um_instructions.h"
+
+void UMLoad_program(Segments segments, const char *program);
+void UMLoad_swap(Word *dst, const Word *src, size_t num_words);
+
+#endif
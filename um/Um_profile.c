@@ -0,0 +1,290 @@
+/*******************************************************
+ *
+ *      Um_profile.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_profile.c contains the implementation of the UM profiler. The
+ *      counter arrays grow with segment 0 and are never shrunk, so when
+ *      LOADP replaces segment 0 the counts for a program counter add up
+ *      over every program that was loaded. The report disassembles each
+ *      hot program counter from the segment 0 loaded at the end of the
+ *      run.
+ *
+ *******************************************************/
+
+#include "Um_profile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS
+ *
+ *******************************************************/
+
+#define TOP_PCS 40
+#define TOP_TARGETS 20
+
+enum { CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+       NAND, HALT, MAP, UNMAP, OUT, IN, LOADP, LV };
+
+static const char *const op_names[UM_PROFILE_OPCODES] = {
+        "CMOV", "SLOAD", "SSTORE", "ADD", "MUL", "DIV", "NAND", "HALT",
+        "MAP", "UNMAP", "OUT", "IN", "LOADP", "LV", "(14)", "(15)"
+};
+
+/* A count with the opcode or program counter it belongs to, so that
+ * sorting needs no state outside the array being sorted. */
+typedef struct {
+        uint64_t count;
+        uint32_t index;
+} Ranked;
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* out_of_memory() function
+ * Parameters:  none
+ *
+ * Returns:     void
+ *
+ * Purpose:     Reports a failed allocation and exits.
+ */
+static void out_of_memory(void)
+{
+        fprintf(stderr, "Out of memory profiling\n");
+        exit(EXIT_FAILURE);
+}
+
+/* by_count() function
+ * Parameters:  a, b: pointers to Ranked counts
+ *
+ * Returns:     qsort() ordering: int type
+ *
+ * Purpose:     Orders counts by decreasing count, then by index.
+ */
+static int by_count(const void *a, const void *b)
+{
+        const Ranked *x = a, *y = b;
+
+        if (x->count != y->count)
+                return x->count < y->count ? 1 : -1;
+        return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* sorted_counts() function
+ * Parameters:  counts: const uint64_t * type; length: uint32_t type;
+ *              num_nonzero: uint32_t * type
+ *
+ * Returns:     The nonzero counts with their indices, largest count first
+ *
+ * Purpose:     Collects and sorts the counts worth reporting. Stores
+ *              their number in *num_nonzero. The caller frees the result.
+ */
+static Ranked *sorted_counts(const uint64_t *counts, uint32_t length,
+                             uint32_t *num_nonzero)
+{
+        Ranked *ranked = malloc(((size_t) length + 1) * sizeof(Ranked));
+        uint32_t i, n = 0;
+
+        if (ranked == NULL)
+                out_of_memory();
+        for (i = 0; i < length; i++) {
+                if (counts[i] != 0) {
+                        ranked[n].count = counts[i];
+                        ranked[n++].index = i;
+                }
+        }
+        qsort(ranked, n, sizeof(Ranked), by_count);
+        *num_nonzero = n;
+        return ranked;
+}
+
+/* print_instruction() function
+ * Parameters:  out: FILE * type; word: Word type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Prints the given word as a UM instruction.
+ */
+static void print_instruction(FILE *out, Word word)
+{
+        unsigned op = word >> 28;
+
+        switch (op) {
+        case LV:
+                fprintf(out, "LV r%u, %u", (word >> 25) & 7,
+                        word & 0x1ffffff);
+                break;
+        case HALT:
+                fprintf(out, "HALT");
+                break;
+        case MAP:
+        case LOADP:
+                fprintf(out, "%s r%u, r%u", op_names[op], (word >> 3) & 7,
+                        word & 7);
+                break;
+        case UNMAP:
+        case OUT:
+        case IN:
+                fprintf(out, "%s r%u", op_names[op], word & 7);
+                break;
+        default:
+                fprintf(out, "%s r%u, r%u, r%u", op_names[op],
+                        (word >> 6) & 7, (word >> 3) & 7, word & 7);
+                break;
+        }
+}
+
+/* percent() function
+ * Parameters:  count: uint64_t type; total: uint64_t type
+ *
+ * Returns:     count as a percentage of total: double type
+ */
+static double percent(uint64_t count, uint64_t total)
+{
+        return total == 0 ? 0.0 : 100.0 * (double) count / (double) total;
+}
+
+/*******************************************************
+ *
+ *      PUBLIC FUNCTIONS
+ *
+ *******************************************************/
+
+/* UMProfile_new() function
+ * Parameters:  report: FILE * type
+ *
+ * Returns:     Initialized UM_profile
+ *
+ * Purpose:     Creates an empty profile whose report will be written to
+ *              the given stream.
+ */
+UM_profile UMProfile_new(FILE *report)
+{
+        UM_profile profile = calloc(1, sizeof(struct UM_profile));
+
+        if (profile == NULL)
+                out_of_memory();
+        profile->report = report;
+        return profile;
+}
+
+/* UMProfile_free() function
+ * Parameters:  profile: UM_profile type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Frees the given profile. Closes the report stream unless
+ *              it is stdout or stderr.
+ */
+void UMProfile_free(UM_profile profile)
+{
+        if (profile == NULL)
+                return;
+        if (profile->report != stdout && profile->report != stderr)
+                fclose(profile->report);
+        free(profile->pc_counts);
+        free(profile->loadp_counts);
+        free(profile);
+}
+
+/* UMProfile_resize() function
+ * Parameters:  profile: UM_profile type; length: uint32_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Makes room for counts of program counters below length,
+ *              keeping the counts already taken. Called whenever segment
+ *              0 is loaded or replaced.
+ */
+void UMProfile_resize(UM_profile profile, uint32_t length)
+{
+        uint64_t *pc_counts, *loadp_counts;
+        size_t old_bytes = profile->length * sizeof(uint64_t);
+        size_t new_bytes = ((size_t) length + 1) * sizeof(uint64_t);
+
+        profile->programs_loaded++;
+        if (length <= profile->length && profile->pc_counts != NULL)
+                return;
+        pc_counts = realloc(profile->pc_counts, new_bytes);
+        loadp_counts = realloc(profile->loadp_counts, new_bytes);
+        if (pc_counts == NULL || loadp_counts == NULL)
+                out_of_memory();
+        memset((char *) pc_counts + old_bytes, 0, new_bytes - old_bytes);
+        memset((char *) loadp_counts + old_bytes, 0,
+               new_bytes - old_bytes);
+        profile->pc_counts = pc_counts;
+        profile->loadp_counts = loadp_counts;
+        profile->length = length;
+}
+
+/* UMProfile_report() function
+ * Parameters:  profile: UM_profile type; code: const Word * type;
+ *              length: uint32_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes the sorted report: every opcode executed, the
+ *              TOP_PCS hottest program counters with their instruction in
+ *              the given segment 0 of the given length, and the
+ *              TOP_TARGETS most frequent LOADP targets.
+ */
+void UMProfile_report(UM_profile profile, const Word *code, uint32_t length)
+{
+        FILE *out = profile->report;
+        uint64_t total = 0;
+        Ranked *ops, *ranked;
+        uint32_t i, n, num_ops;
+
+        for (i = 0; i < UM_PROFILE_OPCODES; i++)
+                total += profile->op_counts[i];
+        ops = sorted_counts(profile->op_counts, UM_PROFILE_OPCODES,
+                            &num_ops);
+
+        fprintf(out, "UM profile: %" PRIu64 " instructions, "
+                "%" PRIu64 " program(s) loaded into segment 0\n",
+                total, profile->programs_loaded);
+        if (profile->programs_loaded > 1)
+                fprintf(out, "Counts per PC add up over every program; "
+                        "instructions are shown from the last one.\n");
+
+        fprintf(out, "\n%-8s %16s %7s\n", "Opcode", "Count", "%");
+        for (i = 0; i < num_ops; i++)
+                fprintf(out, "%-8s %16" PRIu64 " %6.2f%%\n",
+                        op_names[ops[i].index], ops[i].count,
+                        percent(ops[i].count, total));
+        free(ops);
+
+        ranked = sorted_counts(profile->pc_counts, profile->length, &n);
+        fprintf(out, "\nHottest PCs (%u of %u executed)\n",
+                n < TOP_PCS ? n : TOP_PCS, n);
+        fprintf(out, "%10s %16s %7s  %s\n", "PC", "Count", "%",
+                "Instruction");
+        for (i = 0; i < n && i < TOP_PCS; i++) {
+                fprintf(out, "%10u %16" PRIu64 " %6.2f%%  ",
+                        ranked[i].index, ranked[i].count,
+                        percent(ranked[i].count, total));
+                if (ranked[i].index < length)
+                        print_instruction(out, code[ranked[i].index]);
+                fputc('\n', out);
+        }
+        free(ranked);
+
+        ranked = sorted_counts(profile->loadp_counts, profile->length, &n);
+        fprintf(out, "\nHottest LOADP targets in segment 0 (%u of %u)\n",
+                n < TOP_TARGETS ? n : TOP_TARGETS, n);
+        fprintf(out, "%10s %16s %7s\n", "Target", "Count", "% LOADP");
+        for (i = 0; i < n && i < TOP_TARGETS; i++)
+                fprintf(out, "%10u %16" PRIu64 " %6.2f%%\n",
+                        ranked[i].index, ranked[i].count,
+                        percent(ranked[i].count,
+                                profile->op_counts[LOADP]));
+        free(ranked);
+        fflush(out);
+}
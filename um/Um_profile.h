@@ -0,0 +1,41 @@
+/*******************************************************
+ *
+ *      Um_profile.h
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_profile.h contains the interface of the UM profiler. A
+ *      profile holds exact execution counts per opcode, per program
+ *      counter in segment 0, and per LOADP target in segment 0. The
+ *      counters are public so that the UM's profiling loop can bump
+ *      them inline; UMProfile_report() prints them sorted by count.
+ *
+ *******************************************************/
+
+#ifndef UM_PROFILE
+#define UM_PROFILE
+
+#include <stdio.h>
+#include <stdint.h>
+#include "Um_instructions.h"
+
+#define UM_PROFILE_OPCODES 16
+
+struct UM_profile {
+        uint64_t op_counts[UM_PROFILE_OPCODES];
+        uint64_t *pc_counts;
+        uint64_t *loadp_counts;
+        uint32_t length;
+        uint64_t programs_loaded;
+        FILE *report;
+};
+
+typedef struct UM_profile *UM_profile;
+
+UM_profile UMProfile_new(FILE *report);
+void UMProfile_free(UM_profile profile);
+void UMProfile_resize(UM_profile profile, uint32_t length);
+void UMProfile_report(UM_profile profile, const Word *code,
+                      uint32_t length);
+
+#endif
@@ -0,0 +1,231 @@
+/*******************************************************
+ *
+ *      Um_server.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_server.c contains the implementation of the UM fork server
+ *      and its client.
+ *
+ *      There is no framing: a request is the bytes the client sends
+ *      before shutting down its side of the connection, and the reply
+ *      is everything the child writes before it exits. Children are
+ *      not waited for, so the server never blocks on a slow request.
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include "Um_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS
+ *
+ *******************************************************/
+
+#define BACKLOG 128
+#define PUMP_SIZE (64 * 1024)
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* socket_address() function
+ * Parameters:  path: const char * type; addr: struct sockaddr_un * type
+ *
+ * Returns:     true if path fits in a socket address: bool type
+ */
+static bool socket_address(const char *path, struct sockaddr_un *addr)
+{
+        memset(addr, 0, sizeof(*addr));
+        addr->sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr->sun_path)) {
+                fprintf(stderr, "Socket path %s is too long\n", path);
+                return false;
+        }
+        strcpy(addr->sun_path, path);
+        return true;
+}
+
+/* write_all() function
+ * Parameters:  fd: int type; buf: const char * type; length: size_t
+ *
+ * Returns:     true if every byte was written: bool type
+ */
+static bool write_all(int fd, const char *buf, size_t length)
+{
+        ssize_t n;
+
+        while (length > 0) {
+                n = write(fd, buf, length);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return false;
+                buf += n;
+                length -= (size_t) n;
+        }
+        return true;
+}
+
+/*******************************************************
+ *
+ *      PUBLIC FUNCTIONS
+ *
+ *******************************************************/
+
+/* UMServer_listen() function
+ * Parameters:  path: const char * type
+ *
+ * Returns:     true in a child serving a connection; false if the
+ *              socket could not be set up: bool type
+ *
+ * Purpose:     Listens on a Unix domain socket at path, replacing any
+ *              socket file already there, and forks a child for every
+ *              connection. The server itself never returns. The child
+ *              returns with the connection as its standard input and
+ *              output, so the caller runs the UM it loaded before
+ *              listening exactly as it would without the server. That UM
+ *              must not have read input or run yet.
+ */
+bool UMServer_listen(const char *path)
+{
+        struct sockaddr_un addr;
+        int listener, conn;
+        pid_t pid;
+
+        if (!socket_address(path, &addr))
+                return false;
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+                perror("socket");
+                return false;
+        }
+        unlink(path);
+        if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(listener, BACKLOG) != 0) {
+                fprintf(stderr, "Could not listen on %s: %s\n", path,
+                        strerror(errno));
+                close(listener);
+                return false;
+        }
+
+        /* children are reaped by the kernel */
+        signal(SIGCHLD, SIG_IGN);
+        for (;;) {
+                conn = accept(listener, NULL, NULL);
+                if (conn < 0) {
+                        if (errno != EINTR && errno != ECONNABORTED)
+                                perror("accept");
+                        continue;
+                }
+                pid = fork();
+                if (pid == 0) {
+                        close(listener);
+                        signal(SIGCHLD, SIG_DFL);
+                        if (dup2(conn, STDIN_FILENO) < 0 ||
+                            dup2(conn, STDOUT_FILENO) < 0)
+                                _exit(EXIT_FAILURE);
+                        close(conn);
+                        return true;
+                }
+                if (pid < 0)
+                        perror("fork");
+                close(conn);
+        }
+}
+
+/* UMServer_connect() function
+ * Parameters:  path: const char * type
+ *
+ * Returns:     EXIT_SUCCESS if the whole reply was received: int type
+ *
+ * Purpose:     Connects to the server at path, sends it standard input
+ *              (shutting down the sending side at end of input) and
+ *              copies the reply to standard output as it arrives, until
+ *              the server closes the connection. Input and output are
+ *              interleaved, so interactive programs work.
+ */
+int UMServer_connect(const char *path)
+{
+        static char in_buf[PUMP_SIZE], out_buf[PUMP_SIZE];
+        struct sockaddr_un addr;
+        struct pollfd fds[2];
+        size_t in_length = 0, in_offset = 0;
+        bool in_done = false;
+        ssize_t n;
+        int sock;
+
+        if (!socket_address(path, &addr))
+                return EXIT_FAILURE;
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0 ||
+            connect(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+                fprintf(stderr, "Could not connect to %s: %s\n", path,
+                        strerror(errno));
+                return EXIT_FAILURE;
+        }
+
+        for (;;) {
+                fds[0].fd = !in_done && in_length == 0 ? STDIN_FILENO : -1;
+                fds[0].events = POLLIN;
+                fds[1].fd = sock;
+                fds[1].events = POLLIN | (in_length > 0 ? POLLOUT : 0);
+                if (poll(fds, 2, -1) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("poll");
+                        break;
+                }
+                if (fds[0].revents != 0) {
+                        n = read(STDIN_FILENO, in_buf, sizeof(in_buf));
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n <= 0) {
+                                in_done = true;
+                                shutdown(sock, SHUT_WR);
+                        } else {
+                                in_length = (size_t) n;
+                                in_offset = 0;
+                        }
+                }
+                if (fds[1].revents & POLLOUT) {
+                        n = send(sock, in_buf + in_offset, in_length,
+                                 MSG_NOSIGNAL);
+                        if (n < 0 && errno != EINTR) {
+                                /* the server stopped reading */
+                                in_length = 0;
+                                in_done = true;
+                        } else if (n > 0) {
+                                in_offset += (size_t) n;
+                                in_length -= (size_t) n;
+                        }
+                }
+                if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                        n = read(sock, out_buf, sizeof(out_buf));
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n <= 0) {
+                                close(sock);
+                                return n == 0 ? EXIT_SUCCESS
+                                              : EXIT_FAILURE;
+                        }
+                        if (!write_all(STDOUT_FILENO, out_buf, (size_t) n))
+                                break;
+                }
+        }
+        close(sock);
+        return EXIT_FAILURE;
+}
@@ -0,0 +1,25 @@
+/*******************************************************
+ *
+ *      Um_server.h
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_server.h contains the interface of the UM fork server. The
+ *      server process loads a program once and then forks a child for
+ *      every connection to a Unix domain socket; the child shares the
+ *      loaded UM copy-on-write and runs it with the connection as its
+ *      standard input and output. The client streams its own standard
+ *      input to the server, and the output back, until the server
+ *      closes the connection.
+ *
+ *******************************************************/
+
+#ifndef UM_SERVER
+#define UM_SERVER
+
+#include <stdbool.h>
+
+bool UMServer_listen(const char *path);
+int UMServer_connect(const char *path);
+
+#endif
@@ -0,0 +1,363 @@
+/*******************************************************
+ *
+ *      Um_snapshot.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_snapshot.c contains the implementation of the UM snapshot
+ *      module. A snapshot file is laid out as
+ *
+ *        Snapshot_header
+ *        offset table: one uint64_t per segment ID, the file offset of
+ *                      the segment's Segment_header, or 0 if unmapped
+ *        available IDs: the stack of free IDs, bottom first
+ *        segments:     each a Segment_header followed by its words
+ *
+ *      Segments are 8-byte aligned, and segments of a page or more start
+ *      on a page boundary. Segments shared copy-on-write by several IDs
+ *      are written once and keep their reference count, so the restored
+ *      machine shares them the same way.
+ *
+ *      Restoring maps the whole file with MAP_PRIVATE and points the
+ *      segment table into the mapping. Only the header and the two
+ *      tables are read up front; segment pages are faulted in when the
+ *      program touches them and copied by the kernel when it writes
+ *      them, so restoring costs the same for any image size.
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include "Um_snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS AND STRUCT DEFINITIONS
+ *
+ *******************************************************/
+
+#define SNAPSHOT_MAGIC "UMSNAP\r\n"
+#define SNAPSHOT_VERSION 1
+#define NUM_REGS 8
+#define ALIGNMENT 8
+
+typedef struct Snapshot_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t counter;
+        Word registers[NUM_REGS];
+        uint32_t num_segs;
+        uint32_t num_available;
+        uint64_t table_offset;
+        uint64_t available_offset;
+        uint64_t length;
+} Snapshot_header;
+
+/* A segment ID with its words, for finding IDs that share a segment */
+typedef struct Shared_segment {
+        Word *words;
+        Segment_ID ID;
+} Shared_segment;
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* out_of_memory() function
+ * Parameters:  none
+ *
+ * Returns:     void
+ *
+ * Purpose:     Reports a failed allocation and exits.
+ */
+static void out_of_memory(void)
+{
+        fprintf(stderr, "Out of memory taking snapshot\n");
+        exit(EXIT_FAILURE);
+}
+
+/* by_words() function
+ * Parameters:  a, b: pointers to Shared_segment
+ *
+ * Returns:     qsort() ordering by segment address, then by ID: int type
+ */
+static int by_words(const void *a, const void *b)
+{
+        const Shared_segment *x = a, *y = b;
+
+        if (x->words != y->words)
+                return (uintptr_t) x->words < (uintptr_t) y->words ? -1 : 1;
+        return x->ID < y->ID ? -1 : x->ID > y->ID;
+}
+
+/* segment_bytes() function
+ * Parameters:  words: Word * type
+ *
+ * Returns:     Size of the segment with its header in bytes: uint64_t
+ */
+static uint64_t segment_bytes(Word *words)
+{
+        return sizeof(Segment_header) +
+                (uint64_t) SEGMENT_HEADER(words)->length * sizeof(Word);
+}
+
+/* place_segments() function
+ * Parameters:  segments: Segments type; offsets: uint64_t * type;
+ *              start: uint64_t type
+ *
+ * Returns:     Length of the file: uint64_t type
+ *
+ * Purpose:     Chooses the file offset of every mapped segment, starting
+ *              at 'start', and stores it in offsets[ID]. IDs that share a
+ *              segment get the offset of the lowest of them.
+ */
+static uint64_t place_segments(Segments segments, uint64_t *offsets,
+                               uint64_t start)
+{
+        uint64_t page = (uint64_t) sysconf(_SC_PAGESIZE);
+        uint64_t end = start, align, bytes;
+        Shared_segment *shared;
+        uint32_t i, num_shared = 0;
+        Word *words;
+
+        shared = malloc((segments->num_segs + 1) * sizeof(Shared_segment));
+        if (shared == NULL)
+                out_of_memory();
+        for (i = 0; i < segments->num_segs; i++) {
+                words = segments->seg_array[i];
+                offsets[i] = 0;
+                if (words == NULL)
+                        continue;
+                if (SEGMENT_HEADER(words)->refs > 1) {
+                        shared[num_shared].words = words;
+                        shared[num_shared++].ID = i;
+                }
+        }
+        qsort(shared, num_shared, sizeof(Shared_segment), by_words);
+        for (i = 1; i < num_shared; i++)
+                if (shared[i].words == shared[i - 1].words)
+                        offsets[shared[i].ID] = UINT64_MAX;
+
+        for (i = 0; i < segments->num_segs; i++) {
+                words = segments->seg_array[i];
+                if (words == NULL || offsets[i] == UINT64_MAX)
+                        continue;
+                bytes = segment_bytes(words);
+                align = bytes >= page ? page : ALIGNMENT;
+                end = (end + align - 1) / align * align;
+                offsets[i] = end;
+                end += bytes;
+        }
+        for (i = 1; i < num_shared; i++)
+                if (shared[i].words == shared[i - 1].words)
+                        offsets[shared[i].ID] = offsets[shared[i - 1].ID];
+        free(shared);
+        return end;
+}
+
+/* write_at() function
+ * Parameters:  fp: FILE * type; position: uint64_t * type; offset:
+ *              uint64_t type; data: const void * type; size: size_t type
+ *
+ * Returns:     true on success: bool type
+ *
+ * Purpose:     Pads the file with zeros from *position up to offset, then
+ *              writes size bytes of data and advances *position.
+ */
+static bool write_at(FILE *fp, uint64_t *position, uint64_t offset,
+                     const void *data, size_t size)
+{
+        for (; *position < offset; (*position)++)
+                if (putc(0, fp) == EOF)
+                        return false;
+        if (size > 0 && fwrite(data, 1, size, fp) != size)
+                return false;
+        *position += size;
+        return true;
+}
+
+/* read_failed() function
+ * Parameters:  path: const char * type; reason: const char * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Reports a snapshot that cannot be restored and exits.
+ */
+static void read_failed(const char *path, const char *reason)
+{
+        fprintf(stderr, "Could not restore snapshot %s: %s\n", path,
+                reason);
+        exit(EXIT_FAILURE);
+}
+
+/*******************************************************
+ *
+ *      PUBLIC FUNCTIONS
+ *
+ *******************************************************/
+
+/* UMSnapshot_write() function
+ * Parameters:  path: const char * type; registers: const Register *
+ *              type; segments: Segments type; counter: uint32_t type
+ *
+ * Returns:     true if the snapshot was written: bool type
+ *
+ * Purpose:     Writes the given machine state to a snapshot file at path,
+ *              replacing the file only once the snapshot is complete.
+ */
+bool UMSnapshot_write(const char *path, const Register *registers,
+                      Segments segments, uint32_t counter)
+{
+        Snapshot_header header;
+        uint64_t *offsets, position = 0;
+        char *temp_path = malloc(strlen(path) + sizeof(".tmp"));
+        bool ok;
+        uint32_t i;
+        FILE *fp;
+
+        offsets = malloc(((size_t) segments->num_segs + 1) *
+                         sizeof(uint64_t));
+        if (offsets == NULL || temp_path == NULL)
+                out_of_memory();
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.counter = counter;
+        memcpy(header.registers, registers, sizeof(header.registers));
+        header.num_segs = segments->num_segs;
+        header.num_available = segments->num_available;
+        header.table_offset = sizeof(header);
+        header.available_offset = header.table_offset +
+                (uint64_t) header.num_segs * sizeof(uint64_t);
+        header.length = place_segments(segments, offsets,
+                                       header.available_offset +
+                                       (uint64_t) header.num_available *
+                                       sizeof(Segment_ID));
+
+        strcpy(temp_path, path);
+        strcat(temp_path, ".tmp");
+        fp = fopen(temp_path, "wb");
+        ok = fp != NULL;
+        ok = ok && write_at(fp, &position, 0, &header, sizeof(header));
+        ok = ok && write_at(fp, &position, position, offsets,
+                            header.num_segs * sizeof(uint64_t));
+        ok = ok && write_at(fp, &position, position,
+                            segments->available_IDs,
+                            header.num_available * sizeof(Segment_ID));
+        for (i = 0; ok && i < header.num_segs; i++) {
+                /* Shared segments were placed at their first ID */
+                if (offsets[i] < position)
+                        continue;
+                ok = write_at(fp, &position, offsets[i],
+                              SEGMENT_HEADER(segments->seg_array[i]),
+                              segment_bytes(segments->seg_array[i]));
+        }
+        if (fp != NULL && fclose(fp) != 0)
+                ok = false;
+        if (ok)
+                ok = rename(temp_path, path) == 0;
+        else if (fp != NULL)
+                remove(temp_path);
+        free(temp_path);
+        free(offsets);
+        return ok;
+}
+
+/* UMSnapshot_read() function
+ * Parameters:  path: const char * type; registers: Register * type;
+ *              counter: uint32_t * type
+ *
+ * Returns:     Segments restored from the snapshot
+ *
+ * Purpose:     Maps the snapshot file at path and returns its segments,
+ *              which live in the mapping until they are unmapped. Stores
+ *              the saved registers in registers and the saved program
+ *              counter in *counter. Exits with an error message if the
+ *              file is not a valid snapshot.
+ */
+Segments UMSnapshot_read(const char *path, Register *registers,
+                         uint32_t *counter)
+{
+        Snapshot_header *header;
+        const uint64_t *offsets;
+        struct stat buffer;
+        Segments segments;
+        uint64_t length;
+        Word *words;
+        char *image;
+        uint32_t i;
+        int fd;
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0 || fstat(fd, &buffer) != 0)
+                read_failed(path, "cannot open file");
+        length = (uint64_t) buffer.st_size;
+        if (length < sizeof(Snapshot_header))
+                read_failed(path, "not a snapshot");
+        image = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                     0);
+        close(fd);
+        if (image == MAP_FAILED)
+                read_failed(path, "cannot map file");
+
+        header = (Snapshot_header *) image;
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+            header->version != SNAPSHOT_VERSION)
+                read_failed(path, "not a snapshot of this version");
+        if (header->length != length || header->num_segs == 0 ||
+            header->table_offset + (uint64_t) header->num_segs *
+            sizeof(uint64_t) > length || header->available_offset +
+            (uint64_t) header->num_available * sizeof(Segment_ID) > length)
+                read_failed(path, "file is truncated or corrupt");
+
+        segments = UMSegment_new();
+        segments->seg_array = realloc(segments->seg_array,
+                                      header->num_segs * sizeof(Word *));
+        segments->available_IDs = realloc(segments->available_IDs,
+                                          (header->num_available + 1) *
+                                          sizeof(Segment_ID));
+        if (segments->seg_array == NULL || segments->available_IDs == NULL)
+                out_of_memory();
+        segments->num_segs = segments->seg_capacity = header->num_segs;
+        segments->num_available = header->num_available;
+        segments->available_capacity = header->num_available + 1;
+        segments->image = image;
+        segments->image_length = length;
+
+        offsets = (const uint64_t *) (image + header->table_offset);
+        for (i = 0; i < header->num_segs; i++) {
+                if (offsets[i] == 0) {
+                        segments->seg_array[i] = NULL;
+                        continue;
+                }
+                if (offsets[i] % ALIGNMENT != 0 ||
+                    offsets[i] > length - sizeof(Segment_header))
+                        read_failed(path, "bad segment offset");
+                words = (Word *) ((Segment_header *) (image + offsets[i]) +
+                                  1);
+                if (offsets[i] + segment_bytes(words) > length)
+                        read_failed(path, "bad segment length");
+                segments->seg_array[i] = words;
+        }
+        memcpy(segments->available_IDs, image + header->available_offset,
+               header->num_available * sizeof(Segment_ID));
+        for (i = 0; i < header->num_available; i++)
+                if (segments->available_IDs[i] >= header->num_segs ||
+                    segments->seg_array[segments->available_IDs[i]] != NULL)
+                        read_failed(path, "bad available ID");
+        if (segments->seg_array[0] == NULL)
+                read_failed(path, "segment 0 is not mapped");
+
+        memcpy(registers, header->registers, sizeof(header->registers));
+        *counter = header->counter;
+        return segments;
+}
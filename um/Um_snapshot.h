@@ -0,0 +1,29 @@
+/*******************************************************
+ *
+ *      Um_snapshot.h
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_snapshot.h contains the interface of the UM snapshot module.
+ *      A snapshot holds the registers, the program counter, every
+ *      mapped segment and the stack of available segment IDs, so that a
+ *      later run can continue from the same point. Snapshots are read
+ *      back by mapping the file privately: segment words stay in the
+ *      mapping and are only copied, a page at a time, when written.
+ *      Snapshots are specific to the host's byte order.
+ *
+ *******************************************************/
+
+#ifndef UM_SNAPSHOT
+#define UM_SNAPSHOT
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "Um_instructions.h"
+
+bool UMSnapshot_write(const char *path, const Register *registers,
+                      Segments segments, uint32_t counter);
+Segments UMSnapshot_read(const char *path, Register *registers,
+                         uint32_t *counter);
+
+#endif
@@ -0,0 +1,467 @@
+/*******************************************************
+ *
+ *      Um_verify.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_verify.c contains the implementation of the UM differential
+ *      verifier.
+ *
+ *      Standard input is read in full first and pushed to both UMs as
+ *      host input, so they see the same bytes and never wait. Both UMs
+ *      are run with UM_run_for() for 'interval' instructions at a time;
+ *      UM_run_for() stops every engine after exactly the same number of
+ *      instructions, so at each checkpoint the two must agree on their
+ *      status, program counter, registers, the hash of every segment,
+ *      and the output written since the last checkpoint. The output of
+ *      the reference UM is written to standard output as checkpoints
+ *      pass.
+ *
+ *      When a checkpoint disagrees, fresh UMs replay the run up to the
+ *      last checkpoint that agreed, in the same steps, and then run a
+ *      shorter final step; a binary search over its length finds the
+ *      first instruction count after which the engines disagree. That
+ *      is where the divergence shows, which may be a few instructions
+ *      after its cause: every engine runs the last two instructions of
+ *      a budget one at a time, so a probe cannot stop inside a fusion.
+ *
+ *******************************************************/
+
+#include "Um_verify.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS AND STRUCT DEFINITIONS
+ *
+ *******************************************************/
+
+#define NUM_REGS 8
+#define MAX_REPORTED_SEGMENTS 8
+#define INPUT_CHUNK (64 * 1024)
+
+typedef struct Verify {
+        const char *program;
+        const char *snapshot;
+        unsigned char *input;
+        size_t input_length;
+        UM_engine engines[2];
+        uint64_t interval;
+} Verify;
+
+/* Two UMs, one per engine, and where each stopped */
+typedef struct Pair {
+        UM ums[2];
+        UM_status status[2];
+        unsigned char *output[2];
+        size_t output_length[2];
+} Pair;
+
+static const char *const status_names[] = {
+        "halted", "blocked", "running", "failed"
+};
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* read_input() function
+ * Parameters:  v: Verify * type
+ *
+ * Returns:     true if all of standard input was read: bool type
+ */
+static bool read_input(Verify *v)
+{
+        size_t size = 0;
+        unsigned char *input;
+        ssize_t n;
+
+        v->input = NULL;
+        v->input_length = 0;
+        for (;;) {
+                if (v->input_length == size) {
+                        size += INPUT_CHUNK;
+                        input = realloc(v->input, size);
+                        if (input == NULL) {
+                                fprintf(stderr, "Out of memory reading "
+                                        "input\n");
+                                return false;
+                        }
+                        v->input = input;
+                }
+                n = read(STDIN_FILENO, v->input + v->input_length,
+                         size - v->input_length);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0) {
+                        perror("read");
+                        return false;
+                }
+                if (n == 0)
+                        return true;
+                v->input_length += (size_t) n;
+        }
+}
+
+/* write_all() function
+ * Parameters:  buf: const unsigned char * type; length: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes the given bytes to standard output.
+ */
+static void write_all(const unsigned char *buf, size_t length)
+{
+        ssize_t n;
+
+        while (length > 0) {
+                n = write(STDOUT_FILENO, buf, length);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return;
+                buf += n;
+                length -= (size_t) n;
+        }
+}
+
+/* start_pair() function
+ * Parameters:  v: const Verify * type; pair: Pair * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Loads the program, or restores the snapshot, once for
+ *              each engine, with all of the input pushed and the output
+ *              captured.
+ */
+static void start_pair(const Verify *v, Pair *pair)
+{
+        UM um;
+        int i;
+
+        for (i = 0; i < 2; i++) {
+                if (v->program != NULL)
+                        um = UM_new((char *) v->program);
+                else
+                        um = UM_restore(v->snapshot);
+                UM_set_engine(um, v->engines[i]);
+                UM_set_host_input(um);
+                UM_push_input(um, v->input, v->input_length);
+                UM_close_input(um);
+                UM_capture_output(um);
+                pair->ums[i] = um;
+                pair->status[i] = UM_BUDGET;
+                pair->output[i] = NULL;
+                pair->output_length[i] = 0;
+        }
+}
+
+/* run_pair() function
+ * Parameters:  pair: Pair * type; budget: uint64_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Runs both UMs for the given number of instructions and
+ *              takes the output each wrote meanwhile.
+ */
+static void run_pair(Pair *pair, uint64_t budget)
+{
+        int i;
+
+        for (i = 0; i < 2; i++) {
+                pair->status[i] = UM_run_for(pair->ums[i], budget);
+                free(pair->output[i]);
+                pair->output[i] = UM_take_output(pair->ums[i],
+                                                 &pair->output_length[i]);
+        }
+}
+
+/* free_pair() function
+ * Parameters:  pair: Pair * type
+ *
+ * Returns:     void
+ */
+static void free_pair(Pair *pair)
+{
+        int i;
+
+        for (i = 0; i < 2; i++) {
+                free(pair->output[i]);
+                UM_free(pair->ums[i]);
+        }
+}
+
+/* num_segments() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     The number of segment IDs the UM has used: uint32_t type
+ */
+static uint32_t num_segments(UM um)
+{
+        return UM_segments(um)->num_segs;
+}
+
+/* same_output() function
+ * Parameters:  pair: const Pair * type
+ *
+ * Returns:     true if both UMs wrote the same output: bool type
+ */
+static bool same_output(const Pair *pair)
+{
+        return pair->output_length[0] == pair->output_length[1] &&
+               (pair->output_length[0] == 0 ||
+                memcmp(pair->output[0], pair->output[1],
+                       pair->output_length[0]) == 0);
+}
+
+/* agree() function
+ * Parameters:  pair: const Pair * type
+ *
+ * Returns:     true if the two UMs are in the same state and wrote the
+ *              same output: bool type
+ */
+static bool agree(const Pair *pair)
+{
+        UM a = pair->ums[0], b = pair->ums[1];
+        uint32_t ID, num_segs;
+
+        if (pair->status[0] != pair->status[1] ||
+            UM_counter(a) != UM_counter(b) ||
+            memcmp(UM_registers(a), UM_registers(b),
+                   NUM_REGS * sizeof(Word)) != 0 ||
+            !same_output(pair))
+                return false;
+        num_segs = num_segments(a);
+        if (num_segments(b) > num_segs)
+                num_segs = num_segments(b);
+        for (ID = 0; ID < num_segs; ID++)
+                if (UMSegment_hash(UM_segments(a), ID) !=
+                    UMSegment_hash(UM_segments(b), ID))
+                        return false;
+        return true;
+}
+
+/* replay() function
+ * Parameters:  v: const Verify * type; pair: Pair * type; done: uint64_t
+ *              type; last: uint64_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Starts a new pair of UMs and runs them for 'done'
+ *              instructions, in steps of v->interval as the checks did,
+ *              and then for 'last' more.
+ */
+static void replay(const Verify *v, Pair *pair, uint64_t done,
+                   uint64_t last)
+{
+        uint64_t n;
+
+        start_pair(v, pair);
+        for (n = 0; n < done; n += v->interval)
+                run_pair(pair, v->interval);
+        if (last > 0)
+                run_pair(pair, last);
+}
+
+/* report_word() function
+ * Parameters:  um: UM type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Prints the program counter of the given UM and the word
+ *              there, if it is inside segment 0.
+ */
+static void report_word(UM um)
+{
+        uint32_t pc = UM_counter(um);
+        Segments segments = UM_segments(um);
+
+        fprintf(stderr, "pc %" PRIu32, pc);
+        if (pc < (uint32_t) UMSegment_length(segments, 0))
+                fprintf(stderr, " (word 0x%08" PRIx32 ")",
+                        segments->seg_array[0][pc]);
+        fprintf(stderr, "\n");
+}
+
+/* report() function
+ * Parameters:  v: const Verify * type; pair: const Pair * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Prints every difference between the two UMs, listing at
+ *              most MAX_REPORTED_SEGMENTS differing segments.
+ */
+static void report(const Verify *v, const Pair *pair)
+{
+        const char *names[2];
+        const Word *regs[2];
+        uint64_t hashes[2];
+        uint32_t ID, num_segs;
+        size_t i, length;
+        int r, shown = 0;
+
+        names[0] = UM_engine_name(v->engines[0]);
+        names[1] = UM_engine_name(v->engines[1]);
+        regs[0] = UM_registers(pair->ums[0]);
+        regs[1] = UM_registers(pair->ums[1]);
+        if (pair->status[0] != pair->status[1])
+                fprintf(stderr, "  status: %s %s, %s %s\n", names[0],
+                        status_names[pair->status[0]], names[1],
+                        status_names[pair->status[1]]);
+        if (UM_counter(pair->ums[0]) != UM_counter(pair->ums[1]))
+                fprintf(stderr, "  pc: %s %" PRIu32 ", %s %" PRIu32 "\n",
+                        names[0], UM_counter(pair->ums[0]), names[1],
+                        UM_counter(pair->ums[1]));
+        for (r = 0; r < NUM_REGS; r++)
+                if (regs[0][r] != regs[1][r])
+                        fprintf(stderr, "  r%d: %s 0x%08" PRIx32 ", %s "
+                                "0x%08" PRIx32 "\n", r, names[0],
+                                regs[0][r], names[1], regs[1][r]);
+
+        num_segs = num_segments(pair->ums[0]);
+        if (num_segments(pair->ums[1]) > num_segs)
+                num_segs = num_segments(pair->ums[1]);
+        for (ID = 0; ID < num_segs; ID++) {
+                hashes[0] = UMSegment_hash(UM_segments(pair->ums[0]), ID);
+                hashes[1] = UMSegment_hash(UM_segments(pair->ums[1]), ID);
+                if (hashes[0] == hashes[1])
+                        continue;
+                if (shown++ < MAX_REPORTED_SEGMENTS)
+                        fprintf(stderr, "  segment %" PRIu32 ": %s hash "
+                                "%016" PRIx64 ", %s hash %016" PRIx64
+                                "\n", ID, names[0], hashes[0], names[1],
+                                hashes[1]);
+        }
+        if (shown > MAX_REPORTED_SEGMENTS)
+                fprintf(stderr, "  ... and %d more segments\n",
+                        shown - MAX_REPORTED_SEGMENTS);
+
+        if (!same_output(pair)) {
+                length = pair->output_length[0] < pair->output_length[1] ?
+                         pair->output_length[0] : pair->output_length[1];
+                for (i = 0; i < length; i++)
+                        if (pair->output[0][i] != pair->output[1][i])
+                                break;
+                fprintf(stderr, "  output: differs at byte %zu (%s wrote "
+                        "%zu bytes, %s %zu)\n", i, names[0],
+                        pair->output_length[0], names[1],
+                        pair->output_length[1]);
+        }
+}
+
+/* locate() function
+ * Parameters:  v: const Verify * type; done: uint64_t type; window:
+ *              uint64_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Finds and reports the first instruction count after which
+ *              the engines disagree, given that they agree after 'done'
+ *              instructions and not after 'done + window'. Only the
+ *              output written after 'done' is compared.
+ */
+static void locate(const Verify *v, uint64_t done, uint64_t window)
+{
+        uint64_t lo = 0, hi = window, mid;
+        Pair pair;
+
+        while (hi - lo > 1) {
+                mid = lo + (hi - lo) / 2;
+                replay(v, &pair, done, mid);
+                if (agree(&pair))
+                        lo = mid;
+                else
+                        hi = mid;
+                free_pair(&pair);
+        }
+
+        replay(v, &pair, done, lo);
+        fprintf(stderr, "  last agreed after instruction %" PRIu64 " at ",
+                done + lo);
+        report_word(pair.ums[0]);
+        free_pair(&pair);
+
+        replay(v, &pair, done, hi);
+        fprintf(stderr, "  first differ after instruction %" PRIu64 ":\n",
+                done + hi);
+        report(v, &pair);
+        free_pair(&pair);
+}
+
+/*******************************************************
+ *
+ *      PUBLIC FUNCTIONS
+ *
+ *******************************************************/
+
+/* UMVerify_run() function
+ * Parameters:  program: const char * type; snapshot: const char * type;
+ *              reference: UM_engine type; candidate: UM_engine type;
+ *              interval: uint64_t type
+ *
+ * Returns:     EXIT_SUCCESS if the program halted and the engines always
+ *              agreed, EXIT_FAILURE if it failed the same way under
+ *              both, and UMVERIFY_DIVERGED if they disagreed: int type
+ *
+ * Purpose:     Runs the program in the given file, or the given snapshot
+ *              if program is NULL, under both engines and checks them
+ *              against each other every 'interval' instructions, as
+ *              described above. Writes the reference engine's output to
+ *              standard output and a summary, or the divergence, to
+ *              standard error.
+ */
+int UMVerify_run(const char *program, const char *snapshot,
+                 UM_engine reference, UM_engine candidate,
+                 uint64_t interval)
+{
+        uint64_t done = 0, checks = 0;
+        UM_status status;
+        Verify v;
+        Pair pair;
+
+        v.program = program;
+        v.snapshot = snapshot;
+        v.engines[0] = reference;
+        v.engines[1] = candidate;
+        v.interval = interval > 0 ? interval : 1;
+        if (!read_input(&v))
+                return EXIT_FAILURE;
+
+        start_pair(&v, &pair);
+        for (;;) {
+                run_pair(&pair, v.interval);
+                checks++;
+                if (!agree(&pair))
+                        break;
+                write_all(pair.output[0], pair.output_length[0]);
+                if (pair.status[0] != UM_BUDGET)
+                        break;
+                done += v.interval;
+        }
+        status = pair.status[0];
+        if (agree(&pair)) {
+                fprintf(stderr, "%s and %s agree at %" PRIu64
+                        " checkpoints; the program %s at pc %" PRIu32
+                        "\n", UM_engine_name(reference),
+                        UM_engine_name(candidate), checks,
+                        status_names[status], UM_counter(pair.ums[0]));
+                free_pair(&pair);
+                free(v.input);
+                return status == UM_HALTED ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        free_pair(&pair);
+
+        fprintf(stderr, "%s and %s diverge between instructions %" PRIu64
+                " and %" PRIu64 "\n", UM_engine_name(reference),
+                UM_engine_name(candidate), done, done + v.interval);
+        locate(&v, done, v.interval);
+        free(v.input);
+        return UMVERIFY_DIVERGED;
+}
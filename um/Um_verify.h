@@ -0,0 +1,29 @@
+/*******************************************************
+ *
+ *      Um_verify.h
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      Um_verify.h contains the interface of the UM differential
+ *      verifier. It runs one program under two engines in lockstep, on
+ *      the same input, and checks every so many instructions that the
+ *      two UMs have the same registers, program counter, segments and
+ *      output. The first divergence is narrowed down to a single
+ *      instruction count and reported.
+ *
+ *******************************************************/
+
+#ifndef UM_VERIFY
+#define UM_VERIFY
+
+#include <stdint.h>
+#include "Um.h"
+
+#define UMVERIFY_DEFAULT_INTERVAL 1000000
+#define UMVERIFY_DIVERGED 2
+
+int UMVerify_run(const char *program, const char *snapshot,
+                 UM_engine reference, UM_engine candidate,
+                 uint64_t interval);
+
+#endif
@@ -8,25 +8,206 @@
  *      main.c contains the driver for the UM virtual machine. 
  *
  *      The UM is invoked from the command line using the command:
- *      ./um [program.um]
+ *      ./um [--engine=name] [--segments=name] [--profile[=report]]
+ *           [--snapshot=file] [program.um | --restore=file]
+ *      ./um [--engine=name] [--segments=name] --verify=name[,interval]
+ *           [program.um | --restore=file]
+ *      ./um [--segments=name] --server=socket [program.um | --restore=file]
+ *      ./um --connect=socket
+ *
+ *      --engine picks the engine that runs the program: switch,
+ *      threaded or jit. The default is the ENGINE the UM was built with.
+ *
+ *      --segments picks where mapped segments are kept: heap (the
+ *      default) gives each its own allocation; arena packs them into one
+ *      mapping that is compacted when at least half of it is free; huge
+ *      is arena backed by transparent huge pages where available.
+ *
+ *      --verify runs the program under the --engine engine and under the
+ *      named engine side by side, on all of standard input, and checks
+ *      every 'interval' instructions (default 1000000) that both are in
+ *      the same state. The first divergence is reported on stderr and
+ *      the exit status is 2.
+ *
+ *      --profile runs the program with exact per-opcode, per-PC and
+ *      per-LOADP-target counters and writes a sorted report to the given
+ *      file, or to stderr, when the program halts.
+ *
+ *      --snapshot writes a snapshot of the machine to the given file
+ *      just before the program's first IN, and carries on running.
+ *      --restore starts from such a snapshot instead of a program, so
+ *      work done before the first IN is not repeated.
+ *
+ *      --server loads the program (or the snapshot given with
+ *      --restore) once and then serves it on a Unix domain socket,
+ *      forking a copy of the loaded UM for each connection; the
+ *      connection is the program's input and output. It cannot be
+ *      combined with --snapshot, since every copy would write the same
+ *      file, nor with --profile. --connect sends standard input to such
+ *      a server and writes the program's output to standard output.
+ *
+ *      Setting UM_FLUSH_MS in the environment makes the UM flush its
+ *      buffered output at least every UM_FLUSH_MS milliseconds while
+ *      the program is writing.
  *
  *      Uses the UM module to represent the virtual machine. Improper 
  *      usage from the command line results in graceful termination. 
+ *      The exit status is 0 if the program halts, and 1 if it fails
+ *      (an invalid instruction, division by zero, or running off the
+ *      end of segment 0).
  *
  *******************************************************/
 
 #include <stdlib.h>
 #include "Um.h"
+#include "Um_server.h"
+#include "Um_verify.h"
 #include <stdio.h>
-#include <um-dis.h>
+#include <string.h>
 #include <signal.h>
 
+#define PROFILE_OPTION "--profile"
+#define SNAPSHOT_OPTION "--snapshot="
+#define RESTORE_OPTION "--restore="
+#define SERVER_OPTION "--server="
+#define CONNECT_OPTION "--connect="
+#define ENGINE_OPTION "--engine="
+#define VERIFY_OPTION "--verify="
+#define SEGMENTS_OPTION "--segments="
+
+/* has_prefix() function
+ * Parameters:  arg: const char * type; prefix: const char * type
+ *
+ * Returns:     true if arg starts with prefix: int type
+ */
+static int has_prefix(const char *arg, const char *prefix)
+{
+        return strncmp(arg, prefix, strlen(prefix)) == 0;
+}
+
+/* parse_verify() function
+ * Parameters:  arg: const char * type; engine: UM_engine * type;
+ *              interval: uint64_t * type
+ *
+ * Returns:     true if arg is an engine name, optionally followed by a
+ *              comma and a positive interval: int type
+ */
+static int parse_verify(const char *arg, UM_engine *engine,
+                        uint64_t *interval)
+{
+        char name[16];
+        size_t length = strcspn(arg, ",");
+        char *end;
+
+        if (length >= sizeof(name))
+                return 0;
+        memcpy(name, arg, length);
+        name[length] = '\0';
+        if (!UM_engine_named(name, engine))
+                return 0;
+        *interval = UMVERIFY_DEFAULT_INTERVAL;
+        if (arg[length] == '\0')
+                return 1;
+        *interval = strtoull(arg + length + 1, &end, 10);
+        return *end == '\0' && *interval > 0;
+}
+
 int main(int argc, char const *argv[])
 {
-        (void) argc;
+        const char *flush_ms = getenv("UM_FLUSH_MS");
+        const char *profile = NULL, *snapshot = NULL, *restore = NULL;
+        const char *program = NULL, *server = NULL, *verify = NULL;
+        UM_engine engine = UM_default_engine(), candidate;
+        UMSegment_backend backend = UMSEGMENT_HEAP;
+        uint64_t interval;
+        FILE *report = NULL;
+        int i, usage = 0;
+        UM_status status;
+        UM um;
+
         /* check command line arguments */
-        UM um = UM_new((char *) argv[1]);
-        UM_run(um);
+        for (i = 1; i < argc; i++) {
+                if (has_prefix(argv[i], PROFILE_OPTION) && profile == NULL)
+                        profile = argv[i] + strlen(PROFILE_OPTION);
+                else if (has_prefix(argv[i], SNAPSHOT_OPTION))
+                        snapshot = argv[i] + strlen(SNAPSHOT_OPTION);
+                else if (has_prefix(argv[i], RESTORE_OPTION))
+                        restore = argv[i] + strlen(RESTORE_OPTION);
+                else if (has_prefix(argv[i], SERVER_OPTION))
+                        server = argv[i] + strlen(SERVER_OPTION);
+                else if (has_prefix(argv[i], ENGINE_OPTION))
+                        usage |= !UM_engine_named(argv[i] +
+                                                  strlen(ENGINE_OPTION),
+                                                  &engine);
+                else if (has_prefix(argv[i], SEGMENTS_OPTION))
+                        usage |= !UMSegment_backend_named(argv[i] +
+                                                  strlen(SEGMENTS_OPTION),
+                                                  &backend);
+                else if (has_prefix(argv[i], VERIFY_OPTION))
+                        verify = argv[i] + strlen(VERIFY_OPTION);
+                else if (has_prefix(argv[i], CONNECT_OPTION) && argc == 2)
+                        return UMServer_connect(argv[i] +
+                                                strlen(CONNECT_OPTION));
+                else if (program == NULL && argv[i][0] != '-')
+                        program = argv[i];
+                else
+                        usage = 1;
+        }
+        if (usage || (program == NULL) == (restore == NULL) ||
+            (profile != NULL && *profile != '\0' && *profile != '=') ||
+            (server != NULL && (profile != NULL || snapshot != NULL)) ||
+            (verify != NULL && (profile != NULL || server != NULL ||
+                                snapshot != NULL ||
+                                !parse_verify(verify, &candidate,
+                                              &interval)))) {
+                fprintf(stderr, "Usage: %s [--engine=name] "
+                        "[--segments=name] [--profile[=report]]\n"
+                        "       %*s [--snapshot=file] "
+                        "[program.um | --restore=file]\n"
+                        "       %s [--engine=name] [--segments=name] "
+                        "--verify=name[,interval]\n"
+                        "       %*s [program.um | --restore=file]\n"
+                        "       %s [--segments=name] --server=socket "
+                        "[program.um | --restore=file]\n"
+                        "       %s --connect=socket\n"
+                        "Engines: switch, threaded, jit\n"
+                        "Segments: heap, arena, huge\n",
+                        argv[0], (int) strlen(argv[0]), "", argv[0],
+                        (int) strlen(argv[0]), "", argv[0], argv[0]);
+                return EXIT_FAILURE;
+        }
+        UMSegment_set_backend(backend);
+        if (verify != NULL)
+                return UMVerify_run(program, restore, engine, candidate,
+                                    interval);
+        if (profile != NULL) {
+                report = *profile == '=' ? fopen(profile + 1, "w") : stderr;
+                if (report == NULL) {
+                        fprintf(stderr, "Could not open %s for writing\n",
+                                profile + 1);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        if (restore != NULL)
+                um = UM_restore(restore);
+        else
+                um = UM_new((char *) program);
+        UM_set_engine(um, engine);
+        if (flush_ms != NULL)
+                UM_set_flush_interval(um, (unsigned) atoi(flush_ms));
+        if (report != NULL)
+                UM_set_profile(um, report);
+        if (snapshot != NULL)
+                UM_set_snapshot(um, snapshot);
+        if (server != NULL && !UMServer_listen(server)) {
+                UM_free(um);
+                return EXIT_FAILURE;
+        }
+        status = UM_run(um);
+        if (status == UM_FAULT)
+                fprintf(stderr, "%s: program failed at segment 0 address "
+                        "%u\n", argv[0], UM_counter(um));
         UM_free(um);
-        return 0;
-} 
\ No newline at end of file
+        return status == UM_HALTED ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,435 @@
+/*******************************************************
+ *
+ *      microbench.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      microbench.c contains microbenchmarks for the UM's subsystems,
+ *      so that the memory module and the interpreter can be measured
+ *      apart from each other. The segment and register scenarios call
+ *      the UMSegment_* and UMRegister_* functions of Um_instructions.c
+ *      directly. The dispatch scenarios generate small UM programs that
+ *      loop over register or memory instructions and run them through
+ *      UM_run().
+ *
+ *      Every scenario reports nanoseconds and heap allocations per
+ *      operation. Allocations are counted by wrapping malloc, calloc and
+ *      realloc at link time (see the microbench rule in the Makefile).
+ *
+ *      The suite is invoked from the command line using:
+ *      ./microbench [scenario-prefix]
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Um.h"
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS AND STRUCT DEFINITIONS
+ *
+ *******************************************************/
+
+#define CHURN_OPS 500000
+#define BATCH_SIZE 1000
+#define ACCESS_WORDS (1 << 20)
+#define ACCESS_ROUNDS 16
+#define COPY_WORDS (16 << 20)
+#define COPY_OPS 16
+#define REGISTER_OPS 20000000
+#define DISPATCH_ITERATIONS (1 << 22)
+
+enum { CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+       NAND, HALT, MAP, UNMAP, OUT, IN, LOADP, LV };
+
+typedef struct Scenario {
+        const char *name;
+        uint64_t (*run)(long arg);
+        long arg;
+} Scenario;
+
+static uint64_t allocations;
+static volatile Word sink;
+
+/*******************************************************
+ *
+ *      ALLOCATION COUNTING
+ *
+ *******************************************************/
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+        allocations++;
+        return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+        allocations++;
+        return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+        allocations++;
+        return __real_realloc(ptr, size);
+}
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* now_ns() function
+ * Parameters:  none
+ *
+ * Returns:     Monotonic time in nanoseconds: uint64_t type
+ */
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/* next_random() function
+ * Parameters:  state: uint32_t * type
+ *
+ * Returns:     Next value of a xorshift generator: uint32_t type
+ */
+static uint32_t next_random(uint32_t *state)
+{
+        uint32_t x = *state;
+
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return *state = x;
+}
+
+/* new_segments() function
+ * Parameters:  registers: Register * type
+ *
+ * Returns:     Initialized Segments
+ *
+ * Purpose:     Creates a segment array with a one-word segment 0 mapped,
+ *              as the UM has, so that later IDs are never 0.
+ */
+static Segments new_segments(Register *registers)
+{
+        Segments segments = UMSegment_new();
+
+        UMSegment_map(segments, 1, registers, 0);
+        return segments;
+}
+
+/*******************************************************
+ *
+ *      SEGMENT AND REGISTER SCENARIOS
+ *
+ *      Each runs its operations and returns how many it ran.
+ *
+ *******************************************************/
+
+/* map_unmap() function
+ * Purpose:     Maps a segment of arg words and unmaps it again.
+ */
+static uint64_t map_unmap(long arg)
+{
+        Register *registers = UMRegister_new();
+        Segments segments = new_segments(registers);
+        long i;
+
+        for (i = 0; i < CHURN_OPS; i++) {
+                UMSegment_map(segments, arg, registers, 1);
+                UMSegment_unmap(segments, registers[1]);
+        }
+        UMSegment_free(segments);
+        UMRegister_free(registers);
+        return CHURN_OPS;
+}
+
+/* map_unmap_batch() function
+ * Purpose:     Maps BATCH_SIZE segments of arg words, then unmaps them
+ *              all, so that IDs and blocks are recycled in bulk.
+ */
+static uint64_t map_unmap_batch(long arg)
+{
+        Register *registers = UMRegister_new();
+        Segments segments = new_segments(registers);
+        Segment_ID ids[BATCH_SIZE];
+        long i, j;
+
+        for (i = 0; i < CHURN_OPS / BATCH_SIZE; i++) {
+                for (j = 0; j < BATCH_SIZE; j++) {
+                        UMSegment_map(segments, arg, registers, 1);
+                        ids[j] = registers[1];
+                }
+                for (j = 0; j < BATCH_SIZE; j++)
+                        UMSegment_unmap(segments, ids[j]);
+        }
+        UMSegment_free(segments);
+        UMRegister_free(registers);
+        return CHURN_OPS;
+}
+
+/* access_words() function
+ * Purpose:     Stores into and loads from every word of a segment of
+ *              ACCESS_WORDS words with UMSegment_insert() and
+ *              UMSegment_at(), in order if arg is 0 and in a random
+ *              order otherwise. One operation is one store or one load.
+ */
+static uint64_t access_words(long arg)
+{
+        Register *registers = UMRegister_new();
+        Segments segments = new_segments(registers);
+        uint32_t *order = malloc(ACCESS_WORDS * sizeof(uint32_t));
+        uint32_t state = 2463534242u, i, j, round;
+        Word sum = 0;
+
+        for (i = 0; i < ACCESS_WORDS; i++)
+                order[i] = i;
+        for (i = ACCESS_WORDS - 1; arg != 0 && i > 0; i--) {
+                j = next_random(&state) % (i + 1);
+                round = order[i];
+                order[i] = order[j];
+                order[j] = round;
+        }
+        UMSegment_map(segments, ACCESS_WORDS, registers, 1);
+
+        allocations = 0;
+        for (round = 0; round < ACCESS_ROUNDS; round++) {
+                for (i = 0; i < ACCESS_WORDS; i++)
+                        UMSegment_insert(segments, registers[1], order[i],
+                                         i + round);
+                for (i = 0; i < ACCESS_WORDS; i++)
+                        sum += UMSegment_at(segments, registers[1], order[i]);
+        }
+        sink = sum;
+        free(order);
+        UMSegment_free(segments);
+        UMRegister_free(registers);
+        return 2 * (uint64_t) ACCESS_ROUNDS * ACCESS_WORDS;
+}
+
+/* copy() function
+ * Purpose:     Copies a segment of COPY_WORDS words into segment 0, as
+ *              LOADP does. If arg is nonzero, also stores one word into
+ *              segment 0 after each copy, which makes it private.
+ */
+static uint64_t copy(long arg)
+{
+        Register *registers = UMRegister_new();
+        Segments segments = new_segments(registers);
+        long i;
+
+        UMSegment_map(segments, COPY_WORDS, registers, 1);
+        allocations = 0;
+        for (i = 0; i < COPY_OPS; i++) {
+                UMSegment_copy(segments, registers[1], 0);
+                if (arg != 0)
+                        UMSegment_insert(segments, 0, i, i);
+        }
+        UMSegment_free(segments);
+        UMRegister_free(registers);
+        return COPY_OPS;
+}
+
+/* registers() function
+ * Purpose:     Runs UMRegister_add(), UMRegister_nand() and
+ *              UMRegister_move() in turn.
+ */
+static uint64_t registers(long arg)
+{
+        Register *regs = UMRegister_new();
+        long i;
+
+        (void) arg;
+        UMRegister_put(regs, 1, 1);
+        UMRegister_put(regs, 2, 3);
+        for (i = 0; i < REGISTER_OPS; i += 3) {
+                UMRegister_add(regs, 3, 1, 2);
+                UMRegister_nand(regs, 2, 3, 1);
+                UMRegister_move(regs, 1, 3);
+        }
+        sink = UMRegister_get(regs, 1);
+        UMRegister_free(regs);
+        return REGISTER_OPS / 3 * 3;
+}
+
+/*******************************************************
+ *
+ *      DISPATCH SCENARIOS
+ *
+ *******************************************************/
+
+/* Helpers to encode UM instructions */
+static Word three(unsigned op, unsigned a, unsigned b, unsigned c)
+{
+        return (Word) op << 28 | a << 6 | b << 3 | c;
+}
+
+static Word load_value(unsigned a, Word value)
+{
+        return (Word) LV << 28 | a << 25 | value;
+}
+
+/* write_loop() function
+ * Parameters:  path: char * type; memory: int type;
+ *              per_iteration: uint64_t * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes a UM program that runs DISPATCH_ITERATIONS times
+ *              round a loop and halts. The loop body is register
+ *              arithmetic, or loads and stores into a mapped segment if
+ *              memory is nonzero. Stores the number of instructions per
+ *              iteration in *per_iteration.
+ */
+static void write_loop(const char *path, int memory, uint64_t *per_iteration)
+{
+        Word program[64];
+        int n = 0, loop, exit_at, i;
+        FILE *fp;
+
+        /* r1 counts down, r7 = ~0, r5 = loop start, r6 = jump target */
+        program[n++] = load_value(1, DISPATCH_ITERATIONS);
+        program[n++] = three(NAND, 7, 0, 0);
+        program[n++] = load_value(2, 1);
+        program[n++] = three(MAP, 0, 4, 2);
+        program[n++] = load_value(5, 0);
+        loop = n;
+        for (i = 0; i < 4; i++) {
+                if (memory) {
+                        program[n++] = three(SSTORE, 4, 0, 1);
+                        program[n++] = three(SLOAD, 3, 4, 0);
+                } else {
+                        program[n++] = three(ADD, 2, 2, 3);
+                        program[n++] = three(NAND, 3, 2, 1);
+                }
+        }
+        program[n++] = three(ADD, 1, 1, 7);
+        program[n++] = load_value(6, 0);
+        program[n++] = three(CMOV, 6, 5, 1);
+        program[n++] = three(LOADP, 0, 0, 6);
+        exit_at = n;
+        program[n++] = three(HALT, 0, 0, 0);
+        *per_iteration = exit_at - loop;
+
+        program[4] = load_value(5, loop);
+        program[exit_at - 3] = load_value(6, exit_at);
+        fp = fopen(path, "wb");
+        if (fp == NULL) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < n; i++) {
+                fputc(program[i] >> 24, fp);
+                fputc(program[i] >> 16 & 0xff, fp);
+                fputc(program[i] >> 8 & 0xff, fp);
+                fputc(program[i] & 0xff, fp);
+        }
+        fclose(fp);
+}
+
+/* Time of a scenario that times itself, or 0 */
+static uint64_t measured_ns;
+
+/* dispatch() function
+ * Purpose:     Runs a generated loop through UM_run() and returns the
+ *              number of instructions it executed. Only the run itself
+ *              is timed and its allocations counted.
+ */
+static uint64_t dispatch(long arg)
+{
+        char path[] = "/tmp/microbench.XXXXXX";
+        uint64_t per_iteration, start;
+        UM_status status;
+        int fd;
+        UM um;
+
+        fd = mkstemp(path);
+        if (fd < 0) {
+                perror("microbench");
+                exit(EXIT_FAILURE);
+        }
+        close(fd);
+        write_loop(path, arg, &per_iteration);
+
+        um = UM_new(path);
+        allocations = 0;
+        start = now_ns();
+        status = UM_run(um);
+        measured_ns = now_ns() - start;
+        UM_free(um);
+        remove(path);
+        if (status != UM_HALTED) {
+                fprintf(stderr, "microbench: dispatch loop failed\n");
+                exit(EXIT_FAILURE);
+        }
+        return per_iteration * DISPATCH_ITERATIONS;
+}
+
+/*******************************************************
+ *
+ *      DRIVER
+ *
+ *******************************************************/
+
+static const Scenario scenarios[] = {
+        { "map-unmap/1", map_unmap, 1 },
+        { "map-unmap/16", map_unmap, 16 },
+        { "map-unmap/256", map_unmap, 256 },
+        { "map-unmap/4096", map_unmap, 4096 },
+        { "map-unmap/65536", map_unmap, 65536 },
+        { "map-unmap-batch/16", map_unmap_batch, 16 },
+        { "map-unmap-batch/1024", map_unmap_batch, 1024 },
+        { "access/sequential", access_words, 0 },
+        { "access/random", access_words, 1 },
+        { "copy/shared", copy, 0 },
+        { "copy/written", copy, 1 },
+        { "registers", registers, 0 },
+        { "dispatch/alu", dispatch, 0 },
+        { "dispatch/memory", dispatch, 1 },
+};
+
+int main(int argc, char *argv[])
+{
+        const char *prefix = argc > 1 ? argv[1] : "";
+        uint64_t start, elapsed, ops;
+        size_t i;
+
+        if (argc > 2) {
+                fprintf(stderr, "Usage: %s [scenario-prefix]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+        printf("%-24s %14s %10s %12s\n", "scenario", "ops", "ns/op",
+               "allocs/op");
+        for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+                if (strncmp(scenarios[i].name, prefix, strlen(prefix)) != 0)
+                        continue;
+                allocations = 0;
+                measured_ns = 0;
+                start = now_ns();
+                ops = scenarios[i].run(scenarios[i].arg);
+                elapsed = measured_ns != 0 ? measured_ns : now_ns() - start;
+                printf("%-24s %14llu %10.2f %12.4f\n", scenarios[i].name,
+                       (unsigned long long) ops, (double) elapsed / ops,
+                       (double) allocations / ops);
+                fflush(stdout);
+        }
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,344 @@
+/*******************************************************
+ *
+ *      um2c.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      um2c.c contains an ahead-of-time translator from UM programs to
+ *      C. It reads a .um image the same way the UM does and writes a C
+ *      program to stdout in which every word of segment 0 becomes a case
+ *      of a switch on the program counter. The words are split into
+ *      chunks of CHUNK_WORDS, each translated into its own function, so
+ *      that gcc compiles many small functions rather than one the size
+ *      of the program. Straight-line code falls through from case to
+ *      case, and LOADP jumps back to the switch, which gcc compiles into
+ *      a dense jump table; a jump or fall-through into another chunk
+ *      returns to main(), which calls the chunk's function through a
+ *      table.
+ *
+ *      The translated program keeps the UM registers in local variables
+ *      and links against the UM runtime (Um_instructions.c and Um.c). It
+ *      makes its UM before it starts, and OUT and IN go through that UM,
+ *      so output is buffered and flushed (UM_FLUSH_MS included) exactly
+ *      as in the interpreter.
+ *      Programs often keep data in segment 0, so a store into segment 0
+ *      only matters if it changes a word that straight-line code may
+ *      still reach. Segment 0 is split into runs that end at LOADP or
+ *      HALT; a changed word taints every start point of the run that
+ *      contains it, and the program never enters native code at a
+ *      tainted point. When the running code itself is tainted, or when
+ *      the guest loads a new segment 0, execution is handed to the
+ *      interpreter with the current state, as it is for HALT and for
+ *      faults. A self-decompressing program such as sandmark.umz
+ *      therefore runs only its decompressor natively: the program it
+ *      unpacks is loaded with LOADP and runs in the interpreter.
+ *
+ *      The translator is invoked from the command line using:
+ *      ./um2c [program.um] > [program.c]
+ *
+ *******************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "Um_load.h"
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS
+ *
+ *******************************************************/
+
+#define WORDS_PER_LINE 6
+#define CHUNK_WORDS 256
+
+typedef uint32_t Um_instruction;
+
+typedef enum Um_opcode {
+        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+        NAND, HALT, MAP, UNMAP, OUT, IN, LOADP, LV
+} Um_opcode;
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* emit_instruction() function
+ * Parameters:  word: Um_instruction type; pc: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes the C statement for the instruction at pc. HALT,
+ *              words with an invalid opcode (usually data kept in segment
+ *              0) and DIV by zero hand the program to the interpreter,
+ *              which halts or reports the failure.
+ */
+static void emit_instruction(Um_instruction word, size_t pc)
+{
+        unsigned op = word >> 28;
+        unsigned a = (word >> 6) & 7, b = (word >> 3) & 7, c = word & 7;
+
+        printf("        case %zu:\n", pc);
+        switch (op) {
+        case CMOV:
+                printf("                if (r%u != 0)\n"
+                       "                        r%u = r%u;\n", c, a, b);
+                break;
+        case SLOAD:
+                printf("                r%u = segments->seg_array[r%u][r%u];\n",
+                       a, b, c);
+                break;
+        case SSTORE:
+                printf("                UMSegment_writable(segments, r%u)[r%u] = "
+                       "r%u;\n"
+                       "                if (r%u == 0 && modify(r%u, r%u, "
+                       "%zu)) {\n"
+                       "                        pc = %zu;\n"
+                       "                        break;\n"
+                       "                }\n", a, b, c, a, b, c, pc + 1,
+                       pc + 1);
+                break;
+        case ADD:
+                printf("                r%u = r%u + r%u;\n", a, b, c);
+                break;
+        case MUL:
+                printf("                r%u = r%u * r%u;\n", a, b, c);
+                break;
+        case DIV:
+                printf("                if (r%u == 0) {\n"
+                       "                        pc = %zu;\n"
+                       "                        break;\n"
+                       "                }\n"
+                       "                r%u = r%u / r%u;\n", c, pc, a, b, c);
+                break;
+        case NAND:
+                printf("                r%u = ~(r%u & r%u);\n", a, b, c);
+                break;
+        case HALT:
+                printf("                pc = %zu;\n"
+                       "                break;\n", pc);
+                break;
+        case MAP:
+                printf("                UMSegment_map(segments, r%u, "
+                       "map_reg, 0);\n"
+                       "                r%u = map_reg[0];\n", c, b);
+                break;
+        case UNMAP:
+                printf("                UMSegment_unmap(segments, r%u);\n",
+                       c);
+                break;
+        case OUT:
+                printf("                UM_out(um, r%u);\n", c);
+                break;
+        case IN:
+                printf("                r%u = UM_in(um);\n", c);
+                break;
+        case LOADP:
+                printf("                if (r%u != 0) {\n"
+                       "                        pc = %zu;\n"
+                       "                        break;\n"
+                       "                }\n"
+                       "                pc = r%u;\n"
+                       "                continue;\n", b, pc, c);
+                break;
+        case LV:
+                printf("                r%u = %uu;\n", (word >> 25) & 7,
+                       word & 0x1ffffff);
+                break;
+        default:
+                printf("                pc = %zu;\n"
+                       "                break;\n", pc);
+                break;
+        }
+        printf("                /* fallthrough */\n");
+}
+
+/* emit_chunk() function
+ * Parameters:  stream: const Um_instruction * type; start: size_t type;
+ *              end: size_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes the function for the chunk of words from start up
+ *              to end. It runs from the program counter it is given until
+ *              the program counter leaves the chunk, and returns true, or
+ *              until execution must be handed to the interpreter, and
+ *              returns false. The registers are kept in locals while the
+ *              function runs.
+ */
+static void emit_chunk(const Um_instruction *stream, size_t start,
+                       size_t end)
+{
+        size_t i;
+
+        printf("static int chunk_%zu(Word *r, uint32_t *counter)\n"
+               "{\n"
+               "        Word r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];\n"
+               "        Word r4 = r[4], r5 = r[5], r6 = r[6], r7 = r[7];\n"
+               "        uint32_t pc = *counter;\n"
+               "        Register map_reg[1];\n"
+               "        int left = 0;\n\n"
+               "        (void) map_reg;\n"
+               "        for (;;) {\n"
+               "        if (pc < NUM_INSTR && tainted[pc])\n"
+               "                break;\n"
+               "        switch (pc) {\n", start / CHUNK_WORDS);
+        for (i = start; i < end; i++)
+                emit_instruction(stream[i], i);
+        if (end > start)
+                printf("                pc = %zu;\n"
+                       "                left = 1;\n"
+                       "                break;\n", end);
+        printf("        default:\n"
+               "                left = 1;\n"
+               "                break;\n"
+               "        }\n"
+               "        break;\n"
+               "        }\n"
+               "        r[0] = r0;\n"
+               "        r[1] = r1;\n"
+               "        r[2] = r2;\n"
+               "        r[3] = r3;\n"
+               "        r[4] = r4;\n"
+               "        r[5] = r5;\n"
+               "        r[6] = r6;\n"
+               "        r[7] = r7;\n"
+               "        *counter = pc;\n"
+               "        return left;\n"
+               "}\n\n");
+}
+
+/* emit_program() function
+ * Parameters:  stream: Um_instruction * type; num_instr: size_t type;
+ *              program: const char * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Writes the translated C program for the given words.
+ */
+static void emit_program(const Um_instruction *stream, size_t num_instr,
+                         const char *program)
+{
+        size_t i, num_chunks = (num_instr + CHUNK_WORDS - 1) / CHUNK_WORDS;
+
+        if (num_chunks == 0)
+                num_chunks = 1;
+        printf("/* Translated from %s by um2c. Do not edit. */\n\n"
+               "#include \"Um.h\"\n\n", program);
+        printf("static const Word image[%zu] = {", num_instr + 1);
+        for (i = 0; i < num_instr; i++)
+                printf("%s0x%08x,", i % WORDS_PER_LINE ? " " : "\n        ",
+                       stream[i]);
+        printf("\n        0\n};\n\n");
+
+        printf("#define NUM_INSTR %zu\n"
+               "#define CHUNK_WORDS %d\n\n"
+               "static uint32_t run_start[NUM_INSTR + 1];\n"
+               "static unsigned char modified[NUM_INSTR + 1];\n"
+               "static unsigned char tainted[NUM_INSTR + 2];\n"
+               "static Segments segments;\n"
+               "static UM um;\n\n",
+               num_instr, CHUNK_WORDS);
+        printf("/* find_runs() function\n"
+               " * Purpose:     Records for every word of segment 0 the start\n"
+               " *              of the straight-line run containing it. Runs\n"
+               " *              end after each LOADP or HALT.\n"
+               " */\n"
+               "static void find_runs(void)\n"
+               "{\n"
+               "        uint32_t i, start = 0;\n\n"
+               "        for (i = 0; i < NUM_INSTR; i++) {\n"
+               "                run_start[i] = start;\n"
+               "                if (image[i] >> 28 == %d || "
+               "image[i] >> 28 == %d)\n"
+               "                        start = i + 1;\n"
+               "        }\n"
+               "}\n\n", LOADP, HALT);
+        printf("/* modify() function\n"
+               " * Purpose:     Called after a store of value into word addr\n"
+               " *              of segment 0. If the word no longer matches\n"
+               " *              the translation, taints every entry point\n"
+               " *              from which it could be reached by falling\n"
+               " *              through. Returns true if the instruction at\n"
+               " *              next, where execution continues, is tainted.\n"
+               " */\n"
+               "static int modify(uint32_t addr, Word value, uint32_t next)\n"
+               "{\n"
+               "        uint32_t p;\n\n"
+               "        if (addr < NUM_INSTR && !modified[addr] &&\n"
+               "            value != image[addr]) {\n"
+               "                modified[addr] = 1;\n"
+               "                for (p = run_start[addr]; p <= addr; p++)\n"
+               "                        tainted[p] = 1;\n"
+               "        }\n"
+               "        return tainted[next];\n"
+               "}\n\n");
+
+        for (i = 0; i < num_chunks; i++)
+                emit_chunk(stream, i * CHUNK_WORDS,
+                           i + 1 < num_chunks ? (i + 1) * CHUNK_WORDS :
+                                                num_instr);
+        printf("static int (*const chunks[%zu])(Word *, uint32_t *) = {",
+               num_chunks);
+        for (i = 0; i < num_chunks; i++)
+                printf("%schunk_%zu,", i % WORDS_PER_LINE ? " " :
+                                       "\n        ", i);
+        printf("\n};\n\n");
+
+        printf("int main(int argc, char *argv[])\n"
+               "{\n"
+               "        const char *flush_ms = getenv(\"UM_FLUSH_MS\");\n"
+               "        Register *registers = UMRegister_new();\n"
+               "        UM_status status;\n"
+               "        uint32_t pc = 0;\n"
+               "        int i;\n\n"
+               "        (void) argc;\n"
+               "        segments = UMSegment_new();\n"
+               "        UMSegment_map(segments, NUM_INSTR, NULL, 0);\n"
+               "        for (i = 0; i < NUM_INSTR; i++)\n"
+               "                UMSegment_insert(segments, 0, i, image[i]);\n"
+               "        find_runs();\n"
+               "        um = UM_new_from(registers, segments, UMInput_new(0), "
+               "0);\n"
+               "        if (flush_ms != NULL)\n"
+               "                UM_set_flush_interval(um, (unsigned) "
+               "atoi(flush_ms));\n\n"
+               "        while (pc < NUM_INSTR &&\n"
+               "               chunks[pc / CHUNK_WORDS](registers, &pc))\n"
+               "                ;\n\n");
+
+        printf("        /* Segment 0 no longer matches the translation, the\n"
+               "         * program counter left it, or the instruction at pc\n"
+               "         * is one only the interpreter runs: continue in the\n"
+               "         * interpreter. */\n"
+               "        UM_resume_at(um, pc);\n"
+               "        status = UM_run(um);\n"
+               "        if (status == UM_FAULT)\n"
+               "                fprintf(stderr, \"%%s: program failed at \"\n"
+               "                        \"segment 0 address %%u\\n\", "
+               "argv[0],\n"
+               "                        UM_counter(um));\n"
+               "        UM_free(um);\n"
+               "        return status == UM_HALTED ? EXIT_SUCCESS : "
+               "EXIT_FAILURE;\n"
+               "}\n");
+}
+
+int main(int argc, char *argv[])
+{
+        Segments segments;
+        Um_instruction *stream;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s [program.um]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+        segments = UMSegment_new();
+        UMLoad_program(segments, argv[1]);
+        stream = segments->seg_array[0];
+        emit_program(stream, SEGMENT_HEADER(stream)->length, argv[1]);
+        UMSegment_free(segments);
+        return 0;
+}
@@ -0,0 +1,546 @@
+/*******************************************************
+ *
+ *      umbatch.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      umbatch.c contains um-batch, which runs many independent UM jobs
+ *      inside one process. The manifest lists one job per line: a
+ *      program and, optionally, a file to use as its input (no file
+ *      means empty input). Blank lines and lines starting with '#' are
+ *      skipped.
+ *
+ *      Jobs run on a pool of threads, one per core by default. Each
+ *      worker starts with a contiguous share of the jobs and takes them
+ *      in order; a worker that runs out steals the second half of the
+ *      remaining jobs of another worker, so long jobs do not leave the
+ *      other cores idle. Every job gets its own UM with its input pushed
+ *      from memory and its output captured in memory; jobs running the
+ *      same program share one copy of it through the image cache (see
+ *      UM_share_images()). The output is written to <dir>/<job>.out as
+ *      soon as the job finishes if -o is given, and otherwise to
+ *      standard output in manifest order once all jobs are done.
+ *
+ *      The report has one line per job, in manifest order: its number,
+ *      how it ended, wall and CPU time, output size, the worker that ran
+ *      it, and its program and input. With -b, a job that runs more
+ *      than the given number of instructions is stopped and reported as
+ *      'budget'.
+ *
+ *      The tool is invoked from the command line using:
+ *      ./um-batch [-j threads] [-o dir] [-r report] [-b budget] manifest
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include "Um.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS AND STRUCT DEFINITIONS
+ *
+ *******************************************************/
+
+#define MAX_THREADS 256
+#define LINE_SIZE (2 * FILENAME_MAX + 16)
+
+static const char *const status_names[] = {
+        "halted", "blocked", "budget", "fault"
+};
+
+typedef struct Job {
+        char *program;
+        char *input;            /* NULL for empty input */
+        UM_status status;
+        uint32_t counter;
+        double wall_ms, cpu_ms;
+        unsigned char *output;
+        size_t output_length;
+        unsigned worker;
+} Job;
+
+typedef struct Batch {
+        Job *jobs;
+        size_t num_jobs;
+        const char *out_dir;
+        uint64_t budget;        /* 0 for no budget */
+} Batch;
+
+/* A worker's remaining jobs are [top, bottom). The owner takes from the
+ * top and thieves take from the bottom, both under the lock.
+ */
+typedef struct Worker {
+        pthread_t thread;
+        pthread_mutex_t lock;
+        size_t top, bottom;
+        unsigned id;
+        unsigned seed;
+        uint64_t steals;
+        struct Worker *all;
+        unsigned num_workers;
+        Batch *batch;
+} Worker;
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* out_of_memory() function
+ * Parameters:  none
+ *
+ * Returns:     void
+ *
+ * Purpose:     Reports a failed allocation and exits.
+ */
+static void out_of_memory(void)
+{
+        fprintf(stderr, "um-batch: out of memory\n");
+        exit(EXIT_FAILURE);
+}
+
+/* copy_string() function
+ * Parameters:  s: const char * type
+ *
+ * Returns:     A malloc'd copy of s: char * type
+ */
+static char *copy_string(const char *s)
+{
+        char *copy = malloc(strlen(s) + 1);
+
+        if (copy == NULL)
+                out_of_memory();
+        return strcpy(copy, s);
+}
+
+/* read_manifest() function
+ * Parameters:  path: const char * type; batch: Batch * type
+ *
+ * Returns:     true if every job names readable files: int type
+ *
+ * Purpose:     Reads the jobs of the manifest at path ("-" for standard
+ *              input) into the given batch. Files are checked here so
+ *              that a bad line is reported before anything runs.
+ */
+static int read_manifest(const char *path, Batch *batch)
+{
+        char line[LINE_SIZE], program[FILENAME_MAX], input[FILENAME_MAX];
+        FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+        size_t size = 0, line_number = 0;
+        int fields, ok = 1;
+        Job *job;
+
+        if (fp == NULL) {
+                fprintf(stderr, "um-batch: could not open %s\n", path);
+                return 0;
+        }
+        batch->jobs = NULL;
+        batch->num_jobs = 0;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+                line_number++;
+                fields = sscanf(line, "%4095s %4095s", program, input);
+                if (fields < 1 || program[0] == '#')
+                        continue;
+                if (access(program, R_OK) != 0 ||
+                    (fields == 2 && access(input, R_OK) != 0)) {
+                        fprintf(stderr, "um-batch: %s:%zu: cannot read "
+                                "%s\n", path, line_number,
+                                access(program, R_OK) != 0 ? program
+                                                           : input);
+                        ok = 0;
+                        continue;
+                }
+                if (batch->num_jobs == size) {
+                        size = size == 0 ? 64 : size * 2;
+                        job = realloc(batch->jobs, size * sizeof(Job));
+                        if (job == NULL)
+                                out_of_memory();
+                        batch->jobs = job;
+                }
+                job = &batch->jobs[batch->num_jobs++];
+                memset(job, 0, sizeof(*job));
+                job->program = copy_string(program);
+                job->input = fields == 2 ? copy_string(input) : NULL;
+        }
+        if (fp != stdin)
+                fclose(fp);
+        return ok;
+}
+
+/* read_file() function
+ * Parameters:  path: const char * type; length: size_t * type
+ *
+ * Returns:     The malloc'd contents of the file, or NULL if it could
+ *              not be read: unsigned char * type
+ */
+static unsigned char *read_file(const char *path, size_t *length)
+{
+        struct stat buffer;
+        unsigned char *data;
+        size_t done = 0;
+        ssize_t n;
+        int fd = open(path, O_RDONLY);
+
+        if (fd < 0 || fstat(fd, &buffer) != 0) {
+                if (fd >= 0)
+                        close(fd);
+                return NULL;
+        }
+        data = malloc((size_t) buffer.st_size + 1);
+        if (data == NULL)
+                out_of_memory();
+        while (done < (size_t) buffer.st_size) {
+                n = read(fd, data + done, (size_t) buffer.st_size - done);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        break;
+                done += (size_t) n;
+        }
+        close(fd);
+        *length = done;
+        return data;
+}
+
+/* write_file() function
+ * Parameters:  path: const char * type; data: const unsigned char *
+ *              type; length: size_t type
+ *
+ * Returns:     true if the whole file was written: int type
+ */
+static int write_file(const char *path, const unsigned char *data,
+                      size_t length)
+{
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ssize_t n;
+
+        if (fd < 0)
+                return 0;
+        while (length > 0) {
+                n = write(fd, data, length);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        break;
+                data += n;
+                length -= (size_t) n;
+        }
+        close(fd);
+        return length == 0;
+}
+
+/* elapsed_ms() function
+ * Parameters:  start, end: const struct timespec * type
+ *
+ * Returns:     Milliseconds from start to end: double type
+ */
+static double elapsed_ms(const struct timespec *start,
+                         const struct timespec *end)
+{
+        return (double) (end->tv_sec - start->tv_sec) * 1e3 +
+                (double) (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* run_job() function
+ * Parameters:  batch: Batch * type; index: size_t type; worker:
+ *              unsigned type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Runs one job to completion in a UM of its own and records
+ *              the result in the job. The output is written out and freed
+ *              here if the batch has an output directory.
+ */
+static void run_job(Batch *batch, size_t index, unsigned worker)
+{
+        Job *job = &batch->jobs[index];
+        struct timespec wall_start, wall_end, cpu_start, cpu_end;
+        char path[FILENAME_MAX];
+        unsigned char *input;
+        size_t length;
+        UM um;
+
+        clock_gettime(CLOCK_MONOTONIC, &wall_start);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+        um = UM_new(job->program);
+        UM_capture_output(um);
+        UM_set_host_input(um);
+        if (job->input != NULL) {
+                input = read_file(job->input, &length);
+                if (input != NULL)
+                        UM_push_input(um, input, length);
+                free(input);
+        }
+        UM_close_input(um);
+        job->status = batch->budget != 0 ? UM_run_for(um, batch->budget)
+                                         : UM_run(um);
+        job->counter = UM_counter(um);
+        job->output = UM_take_output(um, &job->output_length);
+        UM_free(um);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        clock_gettime(CLOCK_MONOTONIC, &wall_end);
+        job->wall_ms = elapsed_ms(&wall_start, &wall_end);
+        job->cpu_ms = elapsed_ms(&cpu_start, &cpu_end);
+        job->worker = worker;
+
+        if (batch->out_dir != NULL) {
+                snprintf(path, sizeof(path), "%s/%zu.out", batch->out_dir,
+                         index + 1);
+                if (!write_file(path, job->output, job->output_length))
+                        fprintf(stderr, "um-batch: could not write %s\n",
+                                path);
+                free(job->output);
+                job->output = NULL;
+        }
+}
+
+/* take_job() function
+ * Parameters:  w: Worker * type; index: size_t * type
+ *
+ * Returns:     true if a job was taken from w's own jobs: int type
+ */
+static int take_job(Worker *w, size_t *index)
+{
+        int taken;
+
+        pthread_mutex_lock(&w->lock);
+        taken = w->top < w->bottom;
+        if (taken)
+                *index = w->top++;
+        pthread_mutex_unlock(&w->lock);
+        return taken;
+}
+
+/* steal_jobs() function
+ * Parameters:  w: Worker * type; index: size_t * type
+ *
+ * Returns:     true if jobs were stolen: int type
+ *
+ * Purpose:     Moves the second half of another worker's remaining jobs
+ *              to w, which must have none left, and takes the first of
+ *              them. Victims are tried in turn from a random one. Jobs
+ *              are never added, so when no worker has any left the
+ *              batch is done.
+ */
+static int steal_jobs(Worker *w, size_t *index)
+{
+        unsigned n = w->num_workers, start, k;
+        size_t half, top = 0, bottom = 0;
+        Worker *victim;
+
+        start = (unsigned) rand_r(&w->seed) % n;
+        for (k = 0; k < n && top == bottom; k++) {
+                victim = &w->all[(start + k) % n];
+                if (victim == w)
+                        continue;
+                pthread_mutex_lock(&victim->lock);
+                half = (victim->bottom - victim->top + 1) / 2;
+                bottom = victim->bottom;
+                top = bottom - half;
+                victim->bottom = top;
+                pthread_mutex_unlock(&victim->lock);
+        }
+        if (top == bottom)
+                return 0;
+        w->steals++;
+        pthread_mutex_lock(&w->lock);
+        *index = top;
+        w->top = top + 1;
+        w->bottom = bottom;
+        pthread_mutex_unlock(&w->lock);
+        return 1;
+}
+
+/* work() function
+ * Parameters:  arg: the Worker to run: void * type
+ *
+ * Returns:     NULL
+ *
+ * Purpose:     Body of each pool thread: runs its own jobs, then steals
+ *              until there are none left anywhere.
+ */
+static void *work(void *arg)
+{
+        Worker *w = arg;
+        size_t index;
+
+        while (take_job(w, &index) || steal_jobs(w, &index))
+                run_job(w->batch, index, w->id);
+        return NULL;
+}
+
+/* run_batch() function
+ * Parameters:  batch: Batch * type; num_workers: unsigned type;
+ *              steals: uint64_t * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Splits the jobs evenly between num_workers threads, runs
+ *              them all, and stores the total number of steals.
+ */
+static void run_batch(Batch *batch, unsigned num_workers, uint64_t *steals)
+{
+        Worker *workers = calloc(num_workers, sizeof(Worker));
+        unsigned i;
+
+        if (workers == NULL)
+                out_of_memory();
+        for (i = 0; i < num_workers; i++) {
+                pthread_mutex_init(&workers[i].lock, NULL);
+                workers[i].top = batch->num_jobs * i / num_workers;
+                workers[i].bottom = batch->num_jobs * (i + 1) / num_workers;
+                workers[i].id = i;
+                workers[i].seed = i + 1;
+                workers[i].all = workers;
+                workers[i].num_workers = num_workers;
+                workers[i].batch = batch;
+        }
+        for (i = 1; i < num_workers; i++)
+                if (pthread_create(&workers[i].thread, NULL, work,
+                                   &workers[i]) != 0) {
+                        fprintf(stderr, "um-batch: could not start "
+                                "thread %u\n", i);
+                        num_workers = i;
+                        break;
+                }
+        work(&workers[0]);
+        *steals = workers[0].steals;
+        for (i = 1; i < num_workers; i++) {
+                pthread_join(workers[i].thread, NULL);
+                *steals += workers[i].steals;
+        }
+        for (i = 0; i < workers[0].num_workers; i++)
+                pthread_mutex_destroy(&workers[i].lock);
+        free(workers);
+}
+
+/* report_jobs() function
+ * Parameters:  batch: Batch * type; fp: FILE * type
+ *
+ * Returns:     Number of jobs that did not halt: size_t type
+ *
+ * Purpose:     Prints one report line per job, in manifest order.
+ */
+static size_t report_jobs(Batch *batch, FILE *fp)
+{
+        size_t i, failed = 0;
+        Job *job;
+
+        fprintf(fp, "%6s %-7s %10s %10s %10s %6s  %s\n", "job", "status",
+                "wall ms", "cpu ms", "output", "worker", "program [input]");
+        for (i = 0; i < batch->num_jobs; i++) {
+                job = &batch->jobs[i];
+                if (job->status != UM_HALTED)
+                        failed++;
+                fprintf(fp, "%6zu %-7s %10.3f %10.3f %10zu %6u  %s%s%s",
+                        i + 1, status_names[job->status], job->wall_ms,
+                        job->cpu_ms, job->output_length, job->worker,
+                        job->program, job->input != NULL ? " " : "",
+                        job->input != NULL ? job->input : "");
+                if (job->status == UM_FAULT)
+                        fprintf(fp, " (at %" PRIu32 ")", job->counter);
+                fputc('\n', fp);
+        }
+        return failed;
+}
+
+/* usage() function
+ * Parameters:  name: const char * type
+ *
+ * Returns:     EXIT_FAILURE
+ */
+static int usage(const char *name)
+{
+        fprintf(stderr, "Usage: %s [-j threads] [-o dir] [-r report] "
+                "[-b budget] manifest\n", name);
+        return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+        const char *report_path = NULL;
+        struct timespec start, end;
+        double wall_ms, cpu_ms = 0;
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned threads = cores > 0 ? (unsigned) cores : 1;
+        uint64_t steals;
+        size_t i, failed;
+        Batch batch = { NULL, 0, NULL, 0 };
+        FILE *report = stderr;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "j:o:r:b:")) != -1) {
+                switch (opt) {
+                case 'j':
+                        threads = (unsigned) atoi(optarg);
+                        break;
+                case 'o':
+                        batch.out_dir = optarg;
+                        break;
+                case 'r':
+                        report_path = optarg;
+                        break;
+                case 'b':
+                        batch.budget = strtoull(optarg, NULL, 10);
+                        break;
+                default:
+                        return usage(argv[0]);
+                }
+        }
+        if (optind != argc - 1 || threads < 1 || threads > MAX_THREADS)
+                return usage(argv[0]);
+        if (!read_manifest(argv[optind], &batch))
+                return EXIT_FAILURE;
+        if (batch.num_jobs == 0)
+                return EXIT_SUCCESS;
+        if (report_path != NULL && (report = fopen(report_path, "w")) ==
+            NULL) {
+                fprintf(stderr, "um-batch: could not open %s\n",
+                        report_path);
+                return EXIT_FAILURE;
+        }
+        if (threads > batch.num_jobs)
+                threads = (unsigned) batch.num_jobs;
+
+        UM_share_images(true);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        run_batch(&batch, threads, &steals);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        wall_ms = elapsed_ms(&start, &end);
+
+        for (i = 0; i < batch.num_jobs; i++) {
+                if (batch.jobs[i].output != NULL)
+                        fwrite(batch.jobs[i].output, 1,
+                               batch.jobs[i].output_length, stdout);
+                cpu_ms += batch.jobs[i].cpu_ms;
+        }
+        fflush(stdout);
+        failed = report_jobs(&batch, report);
+        fprintf(report, "%zu jobs, %zu failed, %u threads, %" PRIu64
+                " steals, %.3f s wall, %.3f s cpu, %.1f%% utilization\n",
+                batch.num_jobs, failed, threads, steals, wall_ms / 1e3,
+                cpu_ms / 1e3, 100 * cpu_ms / (wall_ms * threads));
+        if (report != stderr)
+                fclose(report);
+
+        for (i = 0; i < batch.num_jobs; i++) {
+                free(batch.jobs[i].program);
+                free(batch.jobs[i].input);
+                free(batch.jobs[i].output);
+        }
+        free(batch.jobs);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
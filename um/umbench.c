@@ -0,0 +1,294 @@
+/*******************************************************
+ *
+ *      umbench.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      umbench.c contains the benchmark driver behind 'make bench'. For
+ *      each program it first runs the UM once with --profile to count
+ *      the guest instructions, then times a number of trials. Each
+ *      trial's output goes to a temporary file and is compared with
+ *      the program's expected output, if there is one: the program name
+ *      with .um or .umz replaced by .out, e.g. sandmark.out. The report
+ *      gives the median wall time with its minimum, maximum and spread,
+ *      the guest instruction rate at the median, and the peak resident
+ *      set size, as reported by wait4(2). An option given with -a,
+ *      such as --segments=arena, is passed to every run of the UM.
+ *
+ *      The driver is invoked from the command line using:
+ *      ./umbench [-n trials] [-a option] um program.um [program.um ...]
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS
+ *
+ *******************************************************/
+
+#define DEFAULT_TRIALS 5
+#define MAX_TRIALS 100
+#define COMPARE_BUF_SIZE (64 * 1024)
+
+/* The option given with -a, or NULL */
+static const char *um_option = NULL;
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* run_um() function
+ * Parameters:  um: const char * type; option: const char * type (may be
+ *              NULL); program: const char * type; out_path: const char *
+ *              type; seconds: double * type; max_rss_kb: long * type
+ *
+ * Returns:     true if the UM exited successfully: int type
+ *
+ * Purpose:     Runs the UM on the given program, with the -a option if
+ *              there is one and then the given option, with standard
+ *              input from /dev/null and standard output into out_path.
+ *              Stores the wall time in *seconds and the child's peak
+ *              resident set size in *max_rss_kb.
+ */
+static int run_um(const char *um, const char *option, const char *program,
+                  const char *out_path, double *seconds, long *max_rss_kb)
+{
+        struct timespec start, end;
+        struct rusage usage;
+        char *args[5];
+        int status, fd, n = 0;
+        pid_t pid;
+
+        args[n++] = (char *) um;
+        if (um_option != NULL)
+                args[n++] = (char *) um_option;
+        if (option != NULL)
+                args[n++] = (char *) option;
+        args[n++] = (char *) program;
+        args[n] = NULL;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pid = fork();
+        if (pid < 0) {
+                perror("fork");
+                return 0;
+        }
+        if (pid == 0) {
+                fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+                if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0)
+                        _exit(127);
+                close(fd);
+                fd = open("/dev/null", O_RDONLY);
+                if (fd < 0 || dup2(fd, STDIN_FILENO) < 0)
+                        _exit(127);
+                close(fd);
+                execv(um, args);
+                _exit(127);
+        }
+        if (wait4(pid, &status, 0, &usage) < 0) {
+                perror("wait4");
+                return 0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        *seconds = (double) (end.tv_sec - start.tv_sec) +
+                (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+        *max_rss_kb = usage.ru_maxrss;
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* count_instructions() function
+ * Parameters:  um: const char * type; program: const char * type;
+ *              scratch: const char * type
+ *
+ * Returns:     Number of guest instructions, or 0 on failure: uint64_t
+ *
+ * Purpose:     Runs the program once under --profile, writing the report
+ *              and the output to scratch files, and reads the instruction
+ *              count from the report's first line.
+ */
+static uint64_t count_instructions(const char *um, const char *program,
+                                   const char *scratch)
+{
+        char option[64 + FILENAME_MAX];
+        char line[256];
+        uint64_t count = 0;
+        double seconds;
+        long rss;
+        FILE *fp;
+
+        snprintf(option, sizeof(option), "--profile=%s.prof", scratch);
+        if (!run_um(um, option, program, scratch, &seconds, &rss))
+                return 0;
+        fp = fopen(option + strlen("--profile="), "r");
+        if (fp == NULL)
+                return 0;
+        if (fgets(line, sizeof(line), fp) == NULL ||
+            sscanf(line, "UM profile: %" SCNu64, &count) != 1)
+                count = 0;
+        fclose(fp);
+        remove(option + strlen("--profile="));
+        return count;
+}
+
+/* expected_output() function
+ * Parameters:  program: const char * type; path: char * type;
+ *              size: size_t type
+ *
+ * Returns:     true if the program has an expected output file: int type
+ *
+ * Purpose:     Writes into path the name of the program's expected
+ *              output (its name with the extension replaced by .out) and
+ *              checks that the file exists.
+ */
+static int expected_output(const char *program, char *path, size_t size)
+{
+        const char *dot = strrchr(program, '.');
+        size_t stem = dot != NULL && strchr(dot, '/') == NULL ?
+                (size_t) (dot - program) : strlen(program);
+
+        if (stem + sizeof(".out") > size)
+                return 0;
+        memcpy(path, program, stem);
+        strcpy(path + stem, ".out");
+        return access(path, R_OK) == 0;
+}
+
+/* same_contents() function
+ * Parameters:  a, b: const char * type
+ *
+ * Returns:     true if the two files have identical contents: int type
+ */
+static int same_contents(const char *a, const char *b)
+{
+        static char buf_a[COMPARE_BUF_SIZE], buf_b[COMPARE_BUF_SIZE];
+        FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+        size_t na, nb;
+        int same = fa != NULL && fb != NULL;
+
+        while (same) {
+                na = fread(buf_a, 1, sizeof(buf_a), fa);
+                nb = fread(buf_b, 1, sizeof(buf_b), fb);
+                if (na != nb || memcmp(buf_a, buf_b, na) != 0)
+                        same = 0;
+                else if (na == 0)
+                        break;
+        }
+        if (fa != NULL)
+                fclose(fa);
+        if (fb != NULL)
+                fclose(fb);
+        return same;
+}
+
+/* by_value() function
+ * Parameters:  a, b: pointers to double
+ *
+ * Returns:     qsort() ordering: int type
+ */
+static int by_value(const void *a, const void *b)
+{
+        double x = *(const double *) a, y = *(const double *) b;
+
+        return x < y ? -1 : x > y;
+}
+
+/* bench_program() function
+ * Parameters:  um: const char * type; program: const char * type;
+ *              trials: int type; scratch: const char * type
+ *
+ * Returns:     true if every run succeeded with the right output: int
+ *
+ * Purpose:     Benchmarks one program and prints its line of the report.
+ */
+static int bench_program(const char *um, const char *program, int trials,
+                         const char *scratch)
+{
+        double times[MAX_TRIALS], median, spread;
+        char expected[FILENAME_MAX];
+        const char *verdict = "-";
+        uint64_t instructions;
+        long rss, max_rss = 0;
+        int i, has_expected, ok = 1;
+
+        has_expected = expected_output(program, expected, sizeof(expected));
+        instructions = count_instructions(um, program, scratch);
+        if (instructions == 0) {
+                fprintf(stderr, "%s: could not profile %s\n", um, program);
+                return 0;
+        }
+        for (i = 0; i < trials; i++) {
+                if (!run_um(um, NULL, program, scratch, &times[i], &rss)) {
+                        fprintf(stderr, "%s: %s failed\n", um, program);
+                        return 0;
+                }
+                if (rss > max_rss)
+                        max_rss = rss;
+                if (has_expected && !same_contents(scratch, expected))
+                        ok = 0;
+        }
+        if (has_expected)
+                verdict = ok ? "OK" : "MISMATCH";
+
+        qsort(times, trials, sizeof(double), by_value);
+        median = trials % 2 ? times[trials / 2] :
+                (times[trials / 2 - 1] + times[trials / 2]) / 2;
+        spread = median > 0 ? 100 * (times[trials - 1] - times[0]) / median
+                : 0;
+        printf("%-24s %6d %9.3f %9.3f %9.3f %6.1f%% %14" PRIu64
+               " %9.1f %9.1f  %s\n", program, trials, median, times[0],
+               times[trials - 1], spread, instructions,
+               instructions / median / 1e6, max_rss / 1024.0, verdict);
+        fflush(stdout);
+        return ok;
+}
+
+int main(int argc, char *argv[])
+{
+        char scratch[] = "/tmp/umbench.XXXXXX";
+        int trials = DEFAULT_TRIALS, first = 1, i, fd, ok = 1;
+
+        while (argc - first > 1 && (strcmp(argv[first], "-n") == 0 ||
+                                    strcmp(argv[first], "-a") == 0)) {
+                if (argv[first][1] == 'n')
+                        trials = atoi(argv[first + 1]);
+                else
+                        um_option = argv[first + 1];
+                first += 2;
+        }
+        if (argc - first < 2 || trials < 1 || trials > MAX_TRIALS) {
+                fprintf(stderr, "Usage: %s [-n trials] [-a option] um "
+                        "program.um [program.um ...]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+        fd = mkstemp(scratch);
+        if (fd < 0) {
+                perror("mkstemp");
+                return EXIT_FAILURE;
+        }
+        close(fd);
+
+        printf("%-24s %6s %9s %9s %9s %7s %14s %9s %9s  %s\n", "program",
+               "trials", "median s", "min s", "max s", "spread",
+               "instructions", "MIPS", "RSS MB", "output");
+        for (i = first + 1; i < argc; i++)
+                if (!bench_program(argv[first], argv[i], trials, scratch))
+                        ok = 0;
+        remove(scratch);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
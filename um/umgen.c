@@ -0,0 +1,607 @@
+/*******************************************************
+ *
+ *      umgen.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      umgen.c contains a generator of synthetic UM programs for stress
+ *      benchmarks. Each pattern isolates one behaviour that midmark and
+ *      sandmark only mix in:
+ *
+ *        storm   map/unmap storms. A window of live segments is kept in
+ *                a slot segment; each step unmaps the oldest, maps a new
+ *                one whose size was drawn from the chosen distribution
+ *                when the program was generated, and stores into it.
+ *        phases  a live set of a fixed number of words whose segment
+ *                size changes over time. Each step of the body is a
+ *                phase with its own size, drawn when the program was
+ *                generated: it replaces the live segments with as many
+ *                of that size as the live set holds, writing every
+ *                page, except one in PHASE_KEEP of the last phase's,
+ *                which stay scattered among the freed ones until the
+ *                next phase.
+ *        smc     self-modifying code. Each step stores an instruction
+ *                into segment 0 with SSTORE and runs it. The stored word
+ *                can flip between two opcodes, rewrite the same word, or
+ *                go to a data area after the code.
+ *        loadp   LOADP trampolines. The loop body is a chain of stubs in
+ *                shuffled order that each jump to the next. Every nth
+ *                jump can load a copy of the program from another
+ *                segment, which replaces segment 0.
+ *        alu     pure ALU loops of random ADD, MUL, DIV, NAND and CMOV
+ *                instructions.
+ *
+ *      Every program runs its loop body the given number of times and
+ *      halts without output. Registers are used as follows: r0 holds 0
+ *      (segment 0), r1 counts the iterations down, r7 holds ~0 for the
+ *      decrement, and r2 to r6 are scratch.
+ *
+ *      The generator is invoked from the command line using:
+ *      ./umgen pattern [-n iterations] [-k body] [-w window]
+ *              [-l live] [-s distribution] [-m mode] [-c every]
+ *              [-r seed] > [program.um]
+ *
+ *******************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS AND STRUCT DEFINITIONS
+ *
+ *******************************************************/
+
+#define MAX_WORDS (1 << 22)
+#define MAX_VALUE 0x1ffffff
+#define DEFAULT_ITERATIONS 100000
+#define DEFAULT_BODY 64
+#define DEFAULT_WINDOW 16
+#define DEFAULT_LIVE (1 << 21)
+#define PHASE_KEEP 16
+#define PAGE_WORDS 1024
+
+typedef uint32_t Um_instruction;
+
+typedef enum Um_opcode {
+        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+        NAND, HALT, MAP, UNMAP, OUT, IN, LOADP, LV
+} Um_opcode;
+
+typedef struct Options {
+        uint32_t iterations;
+        uint32_t body;
+        uint32_t window;
+        uint32_t live;
+        const char *sizes;
+        const char *mode;
+        uint32_t every;
+        uint32_t seed;
+} Options;
+
+/* The program being generated */
+static Um_instruction program[MAX_WORDS];
+static uint32_t length;
+static uint32_t random_state;
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* usage() function
+ * Parameters:  name: const char * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Prints the usage message and exits.
+ */
+static void usage(const char *name)
+{
+        fprintf(stderr,
+                "Usage: %s storm|phases|smc|loadp|alu [options] "
+                "> program.um\n"
+                "  -n iterations  times round the loop (default %d)\n"
+                "  -k body        steps in the loop body (default %d)\n"
+                "  -w window      storm: live segments (default %d)\n"
+                "  -l live        phases: live words (default %d)\n"
+                "  -s sizes       storm, phases: fixed:N, uniform:A-B or "
+                "log:A-B\n"
+                "                 (default uniform:1-64)\n"
+                "  -m mode        smc: flip, same or data (default flip)\n"
+                "  -c every       loadp: copy every nth jump (default 0)\n"
+                "  -r seed        random seed (default 1)\n",
+                name, DEFAULT_ITERATIONS, DEFAULT_BODY, DEFAULT_WINDOW,
+                DEFAULT_LIVE);
+        exit(EXIT_FAILURE);
+}
+
+/* next_random() function
+ * Parameters:  none
+ *
+ * Returns:     Next value of a xorshift generator: uint32_t type
+ */
+static uint32_t next_random(void)
+{
+        uint32_t x = random_state;
+
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return random_state = x;
+}
+
+/* Helpers to emit instructions; each returns the address it used */
+static uint32_t emit(Um_instruction word)
+{
+        if (length == MAX_WORDS) {
+                fprintf(stderr, "umgen: program too long\n");
+                exit(EXIT_FAILURE);
+        }
+        program[length] = word;
+        return length++;
+}
+
+static Um_instruction three(Um_opcode op, unsigned a, unsigned b,
+                            unsigned c)
+{
+        return (Um_instruction) op << 28 | a << 6 | b << 3 | c;
+}
+
+static uint32_t emit_three(Um_opcode op, unsigned a, unsigned b,
+                           unsigned c)
+{
+        return emit(three(op, a, b, c));
+}
+
+static uint32_t emit_lv(unsigned a, uint32_t value)
+{
+        return emit((Um_instruction) LV << 28 | a << 25 | value);
+}
+
+/* patch_lv() function
+ * Parameters:  at: uint32_t type; value: uint32_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Sets the value of the LV at the given address, once the
+ *              address it refers to is known.
+ */
+static void patch_lv(uint32_t at, uint32_t value)
+{
+        program[at] = (program[at] & ~(Um_instruction) MAX_VALUE) | value;
+}
+
+/* emit_constant() function
+ * Parameters:  a: register to load: unsigned type; value: uint32_t type;
+ *              scratch: unsigned type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Loads any 32-bit value into register a, using the scratch
+ *              register if it does not fit in an LV.
+ */
+static void emit_constant(unsigned a, uint32_t value, unsigned scratch)
+{
+        if (value <= MAX_VALUE) {
+                emit_lv(a, value);
+                return;
+        }
+        emit_lv(a, value >> 16);
+        emit_lv(scratch, 1 << 16);
+        emit_three(MUL, a, a, scratch);
+        emit_lv(scratch, value & 0xffff);
+        emit_three(ADD, a, a, scratch);
+}
+
+/* emit_prologue() function
+ * Parameters:  iterations: uint32_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Sets up r7 = ~0 and the iteration count in r1.
+ */
+static void emit_prologue(uint32_t iterations)
+{
+        emit_three(NAND, 7, 0, 0);
+        emit_constant(1, iterations, 2);
+}
+
+/* emit_loop_end() function
+ * Parameters:  loop: address of the loop body: uint32_t type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Counts r1 down and jumps back to the loop body while it is
+ *              not zero, then halts.
+ */
+static void emit_loop_end(uint32_t loop)
+{
+        uint32_t exit_at;
+
+        emit_three(ADD, 1, 1, 7);
+        exit_at = emit_lv(5, 0);
+        emit_lv(2, loop);
+        emit_three(CMOV, 5, 2, 1);
+        emit_three(LOADP, 0, 0, 5);
+        patch_lv(exit_at, emit_three(HALT, 0, 0, 0));
+}
+
+/* draw_size() function
+ * Parameters:  sizes: distribution: const char * type
+ *
+ * Returns:     A segment size drawn from the distribution: uint32_t type
+ */
+static uint32_t draw_size(const char *sizes)
+{
+        unsigned long low, high;
+        uint32_t bits, size;
+
+        if (sscanf(sizes, "fixed:%lu", &low) == 1)
+                return low;
+        if (sscanf(sizes, "uniform:%lu-%lu", &low, &high) == 2 &&
+            low <= high)
+                return low + next_random() % (high - low + 1);
+        if (sscanf(sizes, "log:%lu-%lu", &low, &high) == 2 &&
+            low <= high && low > 0) {
+                /* A power of two of random magnitude, then a random
+                 * size within that power of two */
+                for (bits = 0; (high >> bits) > 1; bits++)
+                        ;
+                do {
+                        size = 1u << (next_random() % (bits + 1));
+                        size += next_random() % size;
+                } while (size < low || size > high);
+                return size;
+        }
+        fprintf(stderr, "umgen: bad size distribution '%s'\n", sizes);
+        exit(EXIT_FAILURE);
+}
+
+/*******************************************************
+ *
+ *      PATTERNS
+ *
+ *******************************************************/
+
+/* gen_storm() function
+ * Purpose:     r6 holds the slot segment of window IDs. Each step k uses
+ *              slot k % window: unmaps its segment, maps a new one of
+ *              the next size into it and stores the counter at offset 0.
+ */
+static void gen_storm(Options *opts)
+{
+        uint32_t k, loop, size;
+
+        if (opts->window == 0 || opts->window > opts->body)
+                opts->window = opts->body;
+        emit_prologue(opts->iterations);
+        emit_constant(2, opts->window, 3);
+        emit_three(MAP, 0, 6, 2);
+        emit_lv(2, 1);
+        for (k = 0; k < opts->window; k++) {
+                emit_three(MAP, 0, 4, 2);
+                emit_lv(3, k);
+                emit_three(SSTORE, 6, 3, 4);
+        }
+
+        loop = length;
+        for (k = 0; k < opts->body; k++) {
+                size = draw_size(opts->sizes);
+                emit_lv(3, k % opts->window);
+                emit_three(SLOAD, 4, 6, 3);
+                emit_three(UNMAP, 0, 0, 4);
+                emit_constant(2, size > 0 ? size : 1, 5);
+                emit_three(MAP, 0, 4, 2);
+                emit_three(SSTORE, 6, 3, 4);
+                emit_three(SSTORE, 4, 0, 1);
+        }
+        emit_loop_end(loop);
+}
+
+/* gen_phases() function
+ * Purpose:     r6 holds a slot segment with room for the most segments
+ *              any phase keeps live; every slot starts out holding a
+ *              one-word segment. Phase j maps live / size segments of
+ *              its size into the first slots, skipping slots i with
+ *              i % PHASE_KEEP == j % PHASE_KEEP that hold a segment of
+ *              the last phase, and puts one-word segments back into the
+ *              slots past those it uses. Each new segment gets the
+ *              counter stored into every page.
+ */
+static void gen_phases(Options *opts)
+{
+        uint32_t *sizes = malloc(opts->body * sizeof(uint32_t));
+        uint32_t *counts = malloc(opts->body * sizeof(uint32_t));
+        uint32_t *held, slots = 1, j, i, offset, size, loop;
+
+        if (sizes == NULL || counts == NULL) {
+                fprintf(stderr, "umgen: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+        for (j = 0; j < opts->body; j++) {
+                sizes[j] = draw_size(opts->sizes);
+                if (sizes[j] == 0)
+                        sizes[j] = 1;
+                counts[j] = opts->live / sizes[j];
+                if (counts[j] == 0)
+                        counts[j] = 1;
+                if (counts[j] > slots)
+                        slots = counts[j];
+        }
+        held = calloc(slots, sizeof(uint32_t));
+        if (held == NULL) {
+                fprintf(stderr, "umgen: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+        emit_prologue(opts->iterations);
+        emit_constant(2, slots, 3);
+        emit_three(MAP, 0, 6, 2);
+        emit_lv(2, 1);
+        for (i = 0; i < slots; i++) {
+                emit_three(MAP, 0, 4, 2);
+                emit_constant(3, i, 5);
+                emit_three(SSTORE, 6, 3, 4);
+        }
+
+        /* held[i] is the size in slot i when the phase starts; the last
+         * phase of one iteration leads into the first of the next */
+        for (j = 0; j < opts->body; j++)
+                for (i = 0; i < slots; i++)
+                        held[i] = i < counts[j] ? sizes[j] : 1;
+        loop = length;
+        for (j = 0; j < opts->body; j++) {
+                for (i = 0; i < slots; i++) {
+                        if (i < counts[j] && held[i] > 1 &&
+                            i % PHASE_KEEP == j % PHASE_KEEP)
+                                continue;
+                        size = i < counts[j] ? sizes[j] : 1;
+                        if (size == 1 && held[i] == 1)
+                                continue;
+                        emit_constant(3, i, 5);
+                        emit_three(SLOAD, 4, 6, 3);
+                        emit_three(UNMAP, 0, 0, 4);
+                        emit_constant(2, size, 5);
+                        emit_three(MAP, 0, 4, 2);
+                        emit_three(SSTORE, 6, 3, 4);
+                        for (offset = 0; offset < size;
+                             offset += PAGE_WORDS) {
+                                emit_constant(2, offset, 5);
+                                emit_three(SSTORE, 4, 2, 1);
+                        }
+                        held[i] = size;
+                }
+        }
+        emit_loop_end(loop);
+        free(sizes);
+        free(counts);
+        free(held);
+}
+
+/* gen_smc() function
+ * Purpose:     Each step stores r3 into a target word and, unless the
+ *              mode is data, runs the target next. After each iteration
+ *              r3 and r6 swap, so in flip mode the targets alternate
+ *              between ADD and NAND. The two words are kept after the
+ *              code, with the data area.
+ */
+static void gen_smc(Options *opts)
+{
+        uint32_t k, loop, load_a, load_b, word_a, word_b;
+        uint32_t *targets = malloc(opts->body * sizeof(uint32_t));
+        int data = strcmp(opts->mode, "data") == 0;
+
+        if (targets == NULL || (!data && strcmp(opts->mode, "flip") != 0 &&
+                                strcmp(opts->mode, "same") != 0)) {
+                fprintf(stderr, "umgen: bad smc mode '%s'\n", opts->mode);
+                exit(EXIT_FAILURE);
+        }
+        word_a = three(ADD, 4, 4, 1);
+        word_b = strcmp(opts->mode, "flip") == 0 ? three(NAND, 4, 4, 1)
+                                                 : word_a;
+        emit_prologue(opts->iterations);
+        load_a = emit_lv(2, 0);
+        emit_three(SLOAD, 3, 0, 2);
+        load_b = emit_lv(2, 0);
+        emit_three(SLOAD, 6, 0, 2);
+
+        loop = length;
+        for (k = 0; k < opts->body; k++) {
+                targets[k] = emit_lv(2, 0);
+                emit_three(SSTORE, 0, 2, 3);
+                if (!data)
+                        patch_lv(targets[k], emit(word_a));
+        }
+        emit_three(CMOV, 2, 3, 7);
+        emit_three(CMOV, 3, 6, 7);
+        emit_three(CMOV, 6, 2, 7);
+        emit_loop_end(loop);
+
+        patch_lv(load_a, emit(word_a));
+        patch_lv(load_b, emit(word_b));
+        for (k = 0; data && k < opts->body; k++)
+                patch_lv(targets[k], emit(0));
+        free(targets);
+}
+
+/* emit_copy_program() function
+ * Parameters:  length_at, index_at: uint32_t * type
+ *
+ * Returns:     void
+ *
+ * Purpose:     Maps a segment into r4 as long as the whole program and
+ *              copies segment 0 into it, word by word from the end. The
+ *              caller patches in the program length, and its last
+ *              address, at the LVs stored in *length_at and *index_at.
+ */
+static void emit_copy_program(uint32_t *length_at, uint32_t *index_at)
+{
+        uint32_t copy, done;
+
+        *length_at = emit_lv(2, 0);
+        emit_three(MAP, 0, 4, 2);
+        *index_at = emit_lv(2, 0);
+
+        copy = length;
+        emit_three(SLOAD, 3, 0, 2);
+        emit_three(SSTORE, 4, 2, 3);
+        done = emit_lv(5, 0);
+        emit_lv(3, copy + 7);
+        emit_three(CMOV, 5, 3, 2);
+        emit_three(ADD, 2, 2, 7);
+        emit_three(LOADP, 0, 0, 5);
+        emit_lv(5, copy);
+        emit_three(LOADP, 0, 0, 5);
+        patch_lv(done, length);
+}
+
+/* gen_loadp() function
+ * Purpose:     The loop body is a chain of stubs of LV r5 and LOADP,
+ *              laid out in shuffled order. Every nth jump loads from the
+ *              copy of the program in r4 instead of from segment 0.
+ */
+static void gen_loadp(Options *opts)
+{
+        uint32_t *order = malloc((opts->body + 1) * sizeof(uint32_t));
+        uint32_t *stubs = malloc((opts->body + 1) * sizeof(uint32_t));
+        uint32_t k, j, t, loop, entry, length_at = 0, index_at = 0;
+
+        if (order == NULL || stubs == NULL) {
+                fprintf(stderr, "umgen: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+        emit_prologue(opts->iterations);
+        if (opts->every > 0)
+                emit_copy_program(&length_at, &index_at);
+        entry = emit_lv(5, 0);
+        emit_three(LOADP, 0, 0, 5);
+
+        /* Stub k jumps to stub k + 1; the last one to the loop end */
+        for (k = 0; k < opts->body; k++)
+                order[k] = k;
+        for (k = opts->body; k > 1; k--) {
+                j = next_random() % k;
+                t = order[k - 1];
+                order[k - 1] = order[j];
+                order[j] = t;
+        }
+        for (k = 0; k < opts->body; k++) {
+                stubs[order[k]] = emit_lv(5, 0);
+                t = opts->every > 0 && (order[k] + 1) % opts->every == 0;
+                emit_three(LOADP, 0, t ? 4 : 0, 5);
+        }
+        loop = length;
+        for (k = 0; k + 1 < opts->body; k++)
+                patch_lv(stubs[k], stubs[k + 1]);
+        patch_lv(stubs[opts->body - 1], loop);
+        patch_lv(entry, stubs[0]);
+        emit_three(ADD, 1, 1, 7);
+        t = emit_lv(5, 0);
+        emit_lv(2, stubs[0]);
+        emit_three(CMOV, 5, 2, 1);
+        emit_three(LOADP, 0, 0, 5);
+        patch_lv(t, emit_three(HALT, 0, 0, 0));
+
+        if (opts->every > 0) {
+                patch_lv(length_at, length);
+                patch_lv(index_at, length - 1);
+        }
+        free(order);
+        free(stubs);
+}
+
+/* gen_alu() function
+ * Purpose:     A loop body of random arithmetic on r2 to r6. DIV only
+ *              divides by r7, which is never zero.
+ */
+static void gen_alu(Options *opts)
+{
+        static const Um_opcode ops[] = { ADD, MUL, NAND, CMOV, DIV };
+        uint32_t k, loop;
+        Um_opcode op;
+
+        emit_prologue(opts->iterations);
+        for (k = 2; k <= 6; k++)
+                emit_lv(k, next_random() & MAX_VALUE);
+
+        loop = length;
+        for (k = 0; k < opts->body; k++) {
+                op = ops[next_random() % 5];
+                emit_three(op, 2 + next_random() % 5, 2 + next_random() % 5,
+                           op == DIV ? 7 : 1 + next_random() % 6);
+        }
+        emit_loop_end(loop);
+}
+
+/* parse_count() function
+ * Parameters:  arg: const char * type; name: const char * type
+ *
+ * Returns:     The parsed count: uint32_t type
+ */
+static uint32_t parse_count(const char *arg, const char *name)
+{
+        char *end;
+        unsigned long value = strtoul(arg, &end, 10);
+
+        if (*arg == '\0' || *end != '\0' || value > UINT32_MAX)
+                usage(name);
+        return value;
+}
+
+int main(int argc, char *argv[])
+{
+        Options opts = { DEFAULT_ITERATIONS, DEFAULT_BODY, DEFAULT_WINDOW,
+                         DEFAULT_LIVE, "uniform:1-64", "flip", 0, 1 };
+        const char *pattern;
+        uint32_t i;
+        int c;
+
+        if (argc < 2 || argv[1][0] == '-')
+                usage(argv[0]);
+        pattern = argv[1];
+        optind = 2;
+        while ((c = getopt(argc, argv, "n:k:w:l:s:m:c:r:")) != -1) {
+                switch (c) {
+                case 'n': opts.iterations = parse_count(optarg, argv[0]);
+                          break;
+                case 'k': opts.body = parse_count(optarg, argv[0]); break;
+                case 'w': opts.window = parse_count(optarg, argv[0]); break;
+                case 'l': opts.live = parse_count(optarg, argv[0]); break;
+                case 's': opts.sizes = optarg; break;
+                case 'm': opts.mode = optarg; break;
+                case 'c': opts.every = parse_count(optarg, argv[0]); break;
+                case 'r': opts.seed = parse_count(optarg, argv[0]); break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind != argc || opts.iterations == 0 || opts.body == 0)
+                usage(argv[0]);
+        random_state = opts.seed != 0 ? opts.seed : 1;
+
+        if (strcmp(pattern, "storm") == 0)
+                gen_storm(&opts);
+        else if (strcmp(pattern, "phases") == 0)
+                gen_phases(&opts);
+        else if (strcmp(pattern, "smc") == 0)
+                gen_smc(&opts);
+        else if (strcmp(pattern, "loadp") == 0)
+                gen_loadp(&opts);
+        else if (strcmp(pattern, "alu") == 0)
+                gen_alu(&opts);
+        else
+                usage(argv[0]);
+
+        for (i = 0; i < length; i++) {
+                putchar(program[i] >> 24);
+                putchar(program[i] >> 16 & 0xff);
+                putchar(program[i] >> 8 & 0xff);
+                putchar(program[i] & 0xff);
+        }
+        return fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,254 @@
+/*******************************************************
+ *
+ *      umtest.c
+ *      by Greg Pickart and Eli Rosmarin
+ *
+ *      COMP 40 Fall 2017 - HW6 'UM'
+ *      umtest.c contains umtest, which checks that UM_run_for() runs
+ *      exactly the number of instructions it is given on every engine.
+ *
+ *      For each program, the switch engine is first checked against
+ *      itself: STEP_CHECK instructions run one UM_run_for(um, 1) at a
+ *      time must leave the same state as one UM_run_for() of the same
+ *      budget. Then every engine runs the program in lockstep with the
+ *      switch engine, both given the same pseudo-random sequence of
+ *      budgets, from single instructions up to MAX_CHUNK. After every
+ *      step the two UMs must agree on the status, the program counter,
+ *      the registers and the output, and at the end on every segment.
+ *      Programs get no input, and each is run for at most
+ *      MAX_INSTRUCTIONS instructions.
+ *
+ *      The tool is invoked from the command line using:
+ *      ./umtest program.um...
+ *
+ *      The exit status is 0 if every engine agreed on every program.
+ *
+ *******************************************************/
+
+#include "Um.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*******************************************************
+ *
+ *      CONSTANT DEFINITIONS
+ *
+ *******************************************************/
+
+#define STEP_CHECK 100000
+#define MAX_CHUNK 4096
+#define MAX_INSTRUCTIONS 20000000
+
+static const char *const status_names[] = {
+        "halted", "blocked", "budget", "fault"
+};
+
+/*******************************************************
+ *
+ *      PRIVATE HELPER FUNCTIONS
+ *
+ *******************************************************/
+
+/* new_um() function
+ * Parameters:  program: const char * type; engine: UM_engine type
+ *
+ * Returns:     A UM loaded with the given program that runs on the given
+ *              engine, with no input and with its output captured: UM
+ */
+static UM new_um(const char *program, UM_engine engine)
+{
+        UM um = UM_new((char *) program);
+
+        UM_set_engine(um, engine);
+        UM_set_host_input(um);
+        UM_close_input(um);
+        UM_capture_output(um);
+        return um;
+}
+
+/* next_chunk() function
+ * Parameters:  seed: uint64_t * type
+ *
+ * Returns:     The next budget of a pseudo-random sequence that mixes
+ *              budgets of a few instructions with budgets of up to
+ *              MAX_CHUNK: uint64_t type
+ */
+static uint64_t next_chunk(uint64_t *seed)
+{
+        uint64_t r;
+
+        *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        r = *seed >> 33;
+        if (r & 1)
+                return 1 + (r >> 1) % 8;
+        return 1 + (r >> 1) % MAX_CHUNK;
+}
+
+/* same_state() function
+ * Parameters:  a, b: UM type; status_a, status_b: UM_status type;
+ *              what: const char * type; engine: const char * type;
+ *              done: uint64_t type
+ *
+ * Returns:     true if the two UMs stopped with the same status, at the
+ *              same program counter, with the same registers and having
+ *              written the same output since the last check: int type
+ *
+ * Purpose:     Compares the state of a reference UM (a) and a UM under
+ *              test (b) after 'done' instructions, and describes the
+ *              first difference on stderr.
+ */
+static int same_state(UM a, UM b, UM_status status_a, UM_status status_b,
+                      const char *what, const char *engine, uint64_t done)
+{
+        const Word *regs_a = UM_registers(a), *regs_b = UM_registers(b);
+        unsigned char *out_a, *out_b;
+        size_t length_a, length_b;
+        int same = 1;
+        unsigned i;
+
+        out_a = UM_take_output(a, &length_a);
+        out_b = UM_take_output(b, &length_b);
+        if (status_a != status_b) {
+                fprintf(stderr, "%s: %s: after %" PRIu64 " instructions "
+                        "status %s, expected %s\n", what, engine, done,
+                        status_names[status_b], status_names[status_a]);
+                same = 0;
+        } else if (UM_counter(a) != UM_counter(b)) {
+                fprintf(stderr, "%s: %s: after %" PRIu64 " instructions "
+                        "pc %u, expected %u\n", what, engine, done,
+                        UM_counter(b), UM_counter(a));
+                same = 0;
+        } else if (length_a != length_b ||
+                   (length_a > 0 && memcmp(out_a, out_b, length_a) != 0)) {
+                fprintf(stderr, "%s: %s: after %" PRIu64 " instructions "
+                        "output differs\n", what, engine, done);
+                same = 0;
+        }
+        for (i = 0; same && i < 8; i++) {
+                if (regs_a[i] != regs_b[i]) {
+                        fprintf(stderr, "%s: %s: after %" PRIu64
+                                " instructions r%u is %u, expected %u\n",
+                                what, engine, done, i, regs_b[i],
+                                regs_a[i]);
+                        same = 0;
+                }
+        }
+        free(out_a);
+        free(out_b);
+        return same;
+}
+
+/* same_segments() function
+ * Parameters:  a, b: UM type; what: const char * type; engine: const
+ *              char * type
+ *
+ * Returns:     true if the two UMs have the same segments mapped, with
+ *              the same contents: int type
+ */
+static int same_segments(UM a, UM b, const char *what, const char *engine)
+{
+        Segments segs_a = UM_segments(a), segs_b = UM_segments(b);
+        Segment_ID ID;
+
+        if (segs_a->num_segs != segs_b->num_segs) {
+                fprintf(stderr, "%s: %s: %u segment IDs, expected %u\n",
+                        what, engine, segs_b->num_segs, segs_a->num_segs);
+                return 0;
+        }
+        for (ID = 0; ID < segs_a->num_segs; ID++) {
+                if (UMSegment_hash(segs_a, ID) !=
+                    UMSegment_hash(segs_b, ID)) {
+                        fprintf(stderr, "%s: %s: segment %u differs\n",
+                                what, engine, ID);
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/* check_steps() function
+ * Parameters:  program: const char * type
+ *
+ * Returns:     true if the switch engine stops in the same state after
+ *              STEP_CHECK single steps as after one run of STEP_CHECK
+ *              instructions: int type
+ */
+static int check_steps(const char *program)
+{
+        UM whole = new_um(program, UM_ENGINE_SWITCH);
+        UM steps = new_um(program, UM_ENGINE_SWITCH);
+        UM_status status_whole, status_steps = UM_BUDGET;
+        uint64_t done;
+        int ok;
+
+        status_whole = UM_run_for(whole, STEP_CHECK);
+        for (done = 0; done < STEP_CHECK && status_steps == UM_BUDGET;
+             done++)
+                status_steps = UM_run_for(steps, 1);
+        ok = same_state(whole, steps, status_whole, status_steps, program,
+                        "switch single steps", done);
+        UM_free(whole);
+        UM_free(steps);
+        return ok;
+}
+
+/* check_engine() function
+ * Parameters:  program: const char * type; engine: UM_engine type
+ *
+ * Returns:     true if the given engine agrees with the switch engine
+ *              after every budget: int type
+ *
+ * Purpose:     Runs the program on the switch engine and on the given
+ *              engine in lockstep, with the same budgets for both.
+ */
+static int check_engine(const char *program, UM_engine engine)
+{
+        const char *name = UM_engine_name(engine);
+        UM reference = new_um(program, UM_ENGINE_SWITCH);
+        UM um = new_um(program, engine);
+        UM_status expected = UM_BUDGET, status;
+        uint64_t seed = 1, done = 0, chunk;
+        int ok = 1;
+
+        while (ok && expected == UM_BUDGET && done < MAX_INSTRUCTIONS) {
+                chunk = next_chunk(&seed);
+                expected = UM_run_for(reference, chunk);
+                status = UM_run_for(um, chunk);
+                done += chunk;
+                ok = same_state(reference, um, expected, status, program,
+                                name, done);
+        }
+        if (ok)
+                ok = same_segments(reference, um, program, name);
+        UM_free(reference);
+        UM_free(um);
+        return ok;
+}
+
+/*******************************************************
+ *
+ *      MAIN
+ *
+ *******************************************************/
+
+int main(int argc, char *argv[])
+{
+        int i, ok, failed = 0;
+        unsigned engine;
+
+        if (argc < 2) {
+                fprintf(stderr, "Usage: %s program.um...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+        for (i = 1; i < argc; i++) {
+                ok = check_steps(argv[i]);
+                for (engine = 0; engine < UM_NUM_ENGINES; engine++)
+                        ok &= check_engine(argv[i], (UM_engine) engine);
+                printf("%s: %s\n", argv[i], ok ? "ok" : "FAILED");
+                failed |= !ok;
+        }
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}